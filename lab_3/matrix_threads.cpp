@@ -1,58 +1,456 @@
 #include <algorithm>
+#include <atomic>
 #include <chrono>
+#include <condition_variable>
+#include <csignal>
+#include <cstdlib>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <functional>
 #include <iostream>
+#include <limits>
+#include <map>
+#include <memory>
 #include <mutex>
 #include <numeric>
 #include <random>
 #include <string>
 #include <thread>
+#include <unordered_map>
 #include <utility>
 #include <vector>
 
+#ifdef __linux__
+#include <cerrno>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+// glibc < 2.35 has SIGEV_THREAD_ID but no name for the target-thread field.
+#ifndef sigev_notify_thread_id
+#define sigev_notify_thread_id _sigev_un._tid
+#endif
+#endif
+
 using namespace std;
 
 inline double getA(const vector<double>& A, int i, int k, int K) { return A[i * K + k]; }
 inline double getB(const vector<double>& B, int k, int j, int N) { return B[k * N + j]; }
 inline double& getC(vector<double>& C, int i, int j, int N)      { return C[i * N + j]; }
 
+// Storage order of an operand. Column-major data (Fortran/R producers) is
+// read in place by the kernel; C is always row-major.
+enum class Layout { RowMajor, ColMajor };
+
+// Element (i,j) of a rows x cols matrix in either layout.
+inline double getL(const vector<double>& X, int i, int j, int rows, int cols, Layout L)
+{
+    return L == Layout::RowMajor ? X[(size_t)i * cols + j] : X[(size_t)j * rows + i];
+}
+
+// Fork/join pool of persistent threads. run(fn) calls fn(t) for every
+// t in [0, size()) -- t = 0 on the calling thread -- and returns once all
+// calls have finished. One job at a time per pool.
+class WorkerPool {
+public:
+    explicit WorkerPool(int threads) : size_(max(1, threads))
+    {
+        for (int t = 1; t < size_; ++t) threads_.emplace_back([this, t] { loop(t); });
+    }
+    ~WorkerPool()
+    {
+        {
+            lock_guard<mutex> lk(mtx_);
+            stop_ = true;
+        }
+        start_cv_.notify_all();
+        for (auto& th : threads_) th.join();
+    }
+    WorkerPool(const WorkerPool&) = delete;
+    WorkerPool& operator=(const WorkerPool&) = delete;
+
+    int size() const { return size_; }
+
+    void run(const function<void(int)>& fn)
+    {
+        {
+            lock_guard<mutex> lk(mtx_);
+            job_ = &fn;
+            pending_ = size_ - 1;
+            ++generation_;
+        }
+        start_cv_.notify_all();
+        fn(0);
+        unique_lock<mutex> lk(mtx_);
+        done_cv_.wait(lk, [this] { return pending_ == 0; });
+        job_ = nullptr;
+    }
+
+private:
+    void loop(int t)
+    {
+        unsigned long long seen = 0;
+        while (true) {
+            const function<void(int)>* job;
+            {
+                unique_lock<mutex> lk(mtx_);
+                start_cv_.wait(lk, [&] { return stop_ || generation_ != seen; });
+                if (stop_) return;
+                seen = generation_;
+                job = job_;
+            }
+            (*job)(t);
+            lock_guard<mutex> lk(mtx_);
+            if (--pending_ == 0) done_cv_.notify_one();
+        }
+    }
+
+    const int size_;
+    vector<thread> threads_;
+    mutex mtx_;
+    condition_variable start_cv_, done_cv_;
+    const function<void(int)>* job_ = nullptr;
+    int pending_ = 0;
+    unsigned long long generation_ = 0;
+    bool stop_ = false;
+};
+
+// Fork-join on a WorkerPool for recursive algorithms: run(root) executes root
+// on the pool's threads, any task may spawn() more, and run returns once
+// every task has finished. Tasks never block on each other; a join is a
+// counter whose last decrement continues the work.
+class TaskGroup {
+public:
+    explicit TaskGroup(WorkerPool& pool) : pool_(pool) {}
+
+    void spawn(function<void()> fn)
+    {
+        lock_guard<mutex> lk(mtx_);
+        q_.push_back(move(fn));
+        ++pending_;
+        cv_.notify_one();
+    }
+
+    void run(function<void()> root)
+    {
+        spawn(move(root));
+        pool_.run([this](int) {
+            unique_lock<mutex> lk(mtx_);
+            while (true) {
+                cv_.wait(lk, [this] { return !q_.empty() || pending_ == 0; });
+                if (q_.empty()) return;
+                function<void()> fn = move(q_.front());
+                q_.pop_front();
+                lk.unlock();
+                fn();
+                lk.lock();
+                if (--pending_ == 0) cv_.notify_all();
+            }
+        });
+    }
+
+private:
+    WorkerPool& pool_;
+    mutex mtx_;
+    condition_variable cv_;
+    deque<function<void()>> q_;
+    size_t pending_ = 0;
+};
+
+struct EngineOptions {
+    bool debug = false;          // per-element trace (--debug)
+    bool reproducible = false;   // fixed summation order (--repro)
+};
+
+// Per-thread counters, padded so neighbouring threads never share a line.
+struct alignas(64) ThreadCounters {
+    long long elements = 0;
+};
+
+// Metrics for long-running modes. Every pool thread owns one shard and is its
+// only writer, so updates are a plain relaxed load + store (no locked
+// instruction, no shared line); readers sum the shards whenever they like.
+// Latencies go into log2 buckets from 1 us up to ~8 s, plus overflow.
+static const int kLatencyBuckets = 24;
+
+enum MetricKernel { kKernelTile, kKernelTileRepro, kKernelStreamPanel, kKernelCount };
+static const char* const kKernelNames[kKernelCount] = {"tile", "tile_repro", "stream_panel"};
+
+inline void bump(atomic<uint64_t>& a, uint64_t v)
+{
+    a.store(a.load(memory_order_relaxed) + v, memory_order_relaxed);
+}
+
+inline uint64_t ns_since(chrono::steady_clock::time_point t0)
+{
+    return (uint64_t)chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - t0).count();
+}
+
+struct LatencyHistogram {
+    atomic<uint64_t> bucket[kLatencyBuckets + 1] = {};   // last one: above 2^23 us
+    atomic<uint64_t> sum_ns{0};
+
+    void observe(uint64_t ns)
+    {
+        const uint64_t us = (ns + 999) / 1000;
+        int b = 0;
+        while (b < kLatencyBuckets && (1ull << b) < us) ++b;
+        bump(bucket[b], 1);
+        bump(sum_ns, ns);
+    }
+};
+
+struct alignas(64) MetricShard {
+    atomic<uint64_t> jobs{0}, flops{0}, bytes{0};
+    LatencyHistogram queue_wait;
+    LatencyHistogram kernel[kKernelCount];
+};
+
+// Plain copy of the summed shards; also the payload of the shared-memory
+// segment, so it must stay trivially copyable.
+struct HistogramSnapshot {
+    uint64_t bucket[kLatencyBuckets + 1];
+    uint64_t sum_ns;
+};
+
+struct MetricsSnapshot {
+    uint64_t jobs, flops, bytes;
+    HistogramSnapshot queue_wait;
+    HistogramSnapshot kernel[kKernelCount];
+};
+
+class Metrics {
+public:
+    explicit Metrics(int shards) : n_(max(1, shards)), shards_(new MetricShard[n_]) {}
+
+    void add_job(int t, uint64_t flops, uint64_t bytes)
+    {
+        bump(shards_[t].jobs, 1);
+        bump(shards_[t].flops, flops);
+        bump(shards_[t].bytes, bytes);
+    }
+    void observe_queue_wait(int t, uint64_t ns) { shards_[t].queue_wait.observe(ns); }
+    void observe_kernel(int t, MetricKernel k, uint64_t ns) { shards_[t].kernel[k].observe(ns); }
+
+    MetricsSnapshot snapshot() const
+    {
+        MetricsSnapshot s;
+        memset(&s, 0, sizeof(s));
+        auto add = [](HistogramSnapshot& dst, const LatencyHistogram& h) {
+            for (int b = 0; b <= kLatencyBuckets; ++b) dst.bucket[b] += h.bucket[b].load(memory_order_relaxed);
+            dst.sum_ns += h.sum_ns.load(memory_order_relaxed);
+        };
+        for (int t = 0; t < n_; ++t) {
+            const MetricShard& sh = shards_[t];
+            s.jobs += sh.jobs.load(memory_order_relaxed);
+            s.flops += sh.flops.load(memory_order_relaxed);
+            s.bytes += sh.bytes.load(memory_order_relaxed);
+            add(s.queue_wait, sh.queue_wait);
+            for (int k = 0; k < kKernelCount; ++k) add(s.kernel[k], sh.kernel[k]);
+        }
+        return s;
+    }
+
+private:
+    int n_;
+    unique_ptr<MetricShard[]> shards_;
+};
+
+// Engine phases for the sampling profiler. Each thread keeps what it is doing
+// in a thread-local word -- phase + kPhaseCount * (kernel + 1), kernel -1
+// meaning "general" -- which the SIGPROF handler reads. Tagging is a plain
+// store on entry and exit, so it stays on whether or not anyone samples.
+enum Phase { kPhaseOther, kPhasePack, kPhaseKernel, kPhaseEpilogue, kPhaseBarrier, kPhaseSteal, kPhaseIO,
+             kPhaseCount };
+static const char* const kPhaseNames[kPhaseCount] = {"other", "pack", "kernel", "epilogue",
+                                                     "barrier", "steal", "io"};
+static const int kPhaseWords = kPhaseCount * (kKernelCount + 1);
 
-static mutex g_print_mtx;
+thread_local volatile sig_atomic_t t_phase_word = kPhaseOther;
+
+class PhaseScope {
+public:
+    explicit PhaseScope(Phase p, int kernel = -1) : saved_(t_phase_word)
+    {
+        t_phase_word = p + kPhaseCount * (kernel + 1);
+    }
+    ~PhaseScope() { t_phase_word = saved_; }
+
+private:
+    sig_atomic_t saved_;
+};
+
+// Everything one multiply needs besides its operands: options, the threads,
+// instrumentation and scratch memory. Nothing is process-wide, so independent
+// multiplies on separate contexts can run concurrently with different settings.
+struct EngineContext {
+    EngineOptions opts;
+    WorkerPool pool;
+    mutex print_mtx;                      // serializes --debug output
+    vector<ThreadCounters> counters;      // one per pool thread
+    vector<vector<double>> scratch;       // per-thread scratch buffers
+    Metrics* metrics = nullptr;           // optional; shard t is written by thread t
+
+    explicit EngineContext(int threads, EngineOptions o = {})
+        : opts(o), pool(threads), counters(pool.size()), scratch(pool.size()) {}
+
+    int threads() const { return pool.size(); }
+
+    // Scratch buffer of thread t with at least n doubles (contents unspecified).
+    double* scratch_for(int t, size_t n)
+    {
+        if (scratch[t].size() < n) scratch[t].resize(n);
+        return scratch[t].data();
+    }
+
+    long long elements_computed() const
+    {
+        long long s = 0;
+        for (const auto& c : counters) s += c.elements;
+        return s;
+    }
+};
+
+// Reproducible summation. Every C element is reduced in the same order no
+// matter which kernel, strategy or thread count produced it: K is cut into
+// fixed chunks of kReproChunk, each chunk is summed sequentially from 0, and
+// the chunk sums are combined by a fixed pairwise tree -- a binary counter
+// (merge older + newer whenever the two newest partials have the same level),
+// then the leftovers folded newest-first. Building with -std=c++17 (not
+// gnu++17) keeps GCC from contracting a*b+c into an FMA, so the rounding is
+// also the same on every ISA.
+static const int kReproChunk = 64;
+
+struct PairwiseStack {
+    double val[64];
+    int level[64];
+    int n = 0;
+
+    void push(double x)
+    {
+        val[n] = x;
+        level[n++] = 0;
+        while (n >= 2 && level[n - 1] == level[n - 2]) {
+            val[n - 2] = val[n - 2] + val[n - 1];
+            ++level[n - 2];
+            --n;
+        }
+    }
+    double finish() const
+    {
+        if (n == 0) return 0.0;
+        double acc = val[n - 1];
+        for (int s = n - 2; s >= 0; --s) acc = val[s] + acc;
+        return acc;
+    }
+};
 
-// Toggle-able debug printing (enabled by --debug flag).
-static bool g_debug = false;
+// sum_k a[k*a_step] * b[k*b_step] in the reproducible order.
+double dot_repro(const double* a, size_t a_step, const double* b, size_t b_step, int K)
+{
+    PairwiseStack st;
+    for (int k0 = 0; k0 < K; k0 += kReproChunk) {
+        const int k1 = min(K, k0 + kReproChunk);
+        double s = 0.0;
+        for (int kk = k0; kk < k1; ++kk) s += a[kk * a_step] * b[kk * b_step];
+        st.push(s);
+    }
+    return st.finish();
+}
 
 // For clarity when we pass work to threads.
 using Task = pair<int,int>; // (row i, col j)
 
 // Multiplies row i of A with column j of B: sum_k A[i,k]*B[k,j].
-double compute_element(const vector<double>& A,
+// Row i of A / column j of B are walked with the stride their layout implies,
+// so a column-major B turns the dot product into two contiguous streams.
+// a_row, when given, is row i of A already packed contiguously.
+double compute_element(EngineContext& ctx,
+                       const vector<double>& A,
                        const vector<double>& B,
                        int i, int j, int M, int K, int N,
-                       int thread_id)
+                       int thread_id,
+                       Layout la = Layout::RowMajor, Layout lb = Layout::RowMajor,
+                       const double* a_row = nullptr)
 {
-    (void)M; // M is unused in the math itself, but kept for symmetry/clarity
+    const double* a = a_row ? a_row : la == Layout::RowMajor ? &A[(size_t)i * K] : &A[i];
+    const size_t a_step = a_row || la == Layout::RowMajor ? 1 : M;
+    const double* b = lb == Layout::RowMajor ? &B[j] : &B[(size_t)j * K];
+    const size_t b_step = lb == Layout::RowMajor ? N : 1;
+
     double sum = 0.0;
-    for (int kk = 0; kk < K; ++kk) {
-        sum += getA(A, i, kk, K) * getB(B, kk, j, N);
+    if (ctx.opts.reproducible) {
+        sum = dot_repro(a, a_step, b, b_step, K);
+    } else if (a_step == 1 && b_step == 1) {
+        for (int kk = 0; kk < K; ++kk) sum += a[kk] * b[kk];
+    } else {
+        for (int kk = 0; kk < K; ++kk) {
+            sum += a[kk * a_step] * b[kk * b_step];
+        }
     }
 
-    if (g_debug) {
-        lock_guard<mutex> lk(g_print_mtx);
+    if (ctx.opts.debug) {
+        lock_guard<mutex> lk(ctx.print_mtx);
         cout << "compute C(" << i << "," << j << ") on thread " << thread_id << "\n";
     }
     return sum;
 }
 
+// Defined with the layout conversion helpers below.
+void transpose_rec(const double* src, double* dst, int rows, int cols,
+                   int r0, int r1, int c0, int c1);
+
+// Rows of a column-major A that a worker packs at a time.
+static const int kPackRows = 64;
+
 // Each thread receives a vector of (i,j) tasks and writes those entries in C.
-void worker(int thread_id,
+// Row i of a column-major A is strided by M, one cache line per element, so
+// the thread instead visits its tasks panel by panel (kPackRows rows of A at
+// a time, stable within a panel) and transposes each panel into its scratch
+// once; every element is still summed in its own fixed order.
+void worker(EngineContext& ctx,
+            int thread_id,
             const vector<Task>& tasks,
             const vector<double>& A, const vector<double>& B,
             vector<double>& C,
-            int M, int K, int N)
+            int M, int K, int N,
+            Layout la, Layout lb)
 {
-    for (auto [i, j] : tasks) {
-        getC(C, i, j, N) = compute_element(A, B, i, j, M, K, N, thread_id);
+    PhaseScope phase(kPhaseKernel);
+    if (la == Layout::RowMajor) {
+        for (auto [i, j] : tasks) {
+            getC(C, i, j, N) = compute_element(ctx, A, B, i, j, M, K, N, thread_id, la, lb);
+        }
+    } else {
+        // Counting sort of the task indices by panel.
+        const int panels = (M + kPackRows - 1) / kPackRows;
+        vector<size_t> start(panels + 1, 0), order(tasks.size());
+        for (const Task& tk : tasks) ++start[tk.first / kPackRows + 1];
+        partial_sum(start.begin(), start.end(), start.begin());
+        vector<size_t> pos(start.begin(), start.end() - 1);
+        for (size_t x = 0; x < tasks.size(); ++x) order[pos[tasks[x].first / kPackRows]++] = x;
+
+        double* panel = ctx.scratch_for(thread_id, (size_t)kPackRows * K);
+        for (int p = 0; p < panels; ++p) {
+            if (start[p] == start[p + 1]) continue;
+            const int p0 = p * kPackRows, p1 = min(M, p0 + kPackRows);
+            transpose_rec(&A[p0], panel, K, M, 0, K, 0, p1 - p0);
+            for (size_t x = start[p]; x < start[p + 1]; ++x) {
+                auto [i, j] = tasks[order[x]];
+                getC(C, i, j, N) = compute_element(ctx, A, B, i, j, M, K, N, thread_id, la, lb,
+                                                   panel + (size_t)(i - p0) * K);
+            }
+        }
     }
+    ctx.counters[thread_id].elements += (long long)tasks.size();
 }
 
 // All return a vector sized num_threads; each entry holds that thread's tasks
@@ -128,6 +526,16 @@ vector<vector<Task>> make_tasks(int M, int N, int T, Strategy s)
     return {};
 }
 
+// Runs the per-thread task lists on the context's pool (tasks.size() must
+// equal ctx.threads()).
+void multiply_tasks(EngineContext& ctx, const vector<vector<Task>>& tasks,
+                    const vector<double>& A, const vector<double>& B, vector<double>& C,
+                    int M, int K, int N,
+                    Layout la = Layout::RowMajor, Layout lb = Layout::RowMajor)
+{
+    ctx.pool.run([&](int t) { worker(ctx, t, tasks[t], A, B, C, M, K, N, la, lb); });
+}
+
 // Single-thread baseline for correctness & timing
 vector<double> multiply_baseline(const vector<double>& A,
                                  const vector<double>& B,
@@ -156,105 +564,5423 @@ double max_abs_diff(const vector<double>& X, const vector<double>& Y)
     return m;
 }
 
-int main(int argc, char** argv)
+// FNV-1a over the bit patterns of X, to compare results across runs/machines.
+uint64_t bit_checksum(const vector<double>& X)
 {
-    // Usage: prog M K N T strategy[rows|cols|everyk] [--debug] [--random]
-    if (argc < 6) {
-        cerr << "Usage: " << argv[0] << " M K N T strategy(rows|cols|everyk) [--debug] [--random]\n";
-        return 1;
+    uint64_t h = 1469598103934665603ULL;
+    const unsigned char* p = reinterpret_cast<const unsigned char*>(X.data());
+    for (size_t i = 0; i < X.size() * sizeof(double); ++i) {
+        h ^= p[i];
+        h *= 1099511628211ULL;
     }
+    return h;
+}
 
-    const int M = stoi(argv[1]);
-    const int K = stoi(argv[2]);
-    const int N = stoi(argv[3]);
-    const int T = max(1, stoi(argv[4]));
-    string sarg = argv[5];
+// ---------------------------------------------------------------------------
+// Banded matrices
+// ---------------------------------------------------------------------------
 
-    Strategy strat = Strategy::Rows;
-    if (sarg == "cols")    strat = Strategy::Cols;
-    else if (sarg == "everyk") strat = Strategy::EveryK;
-    else if (sarg != "rows") {
-        cerr << "Unknown strategy: " << sarg << " (use rows|cols|everyk)\n";
+// Compact band storage: row i keeps columns [i-lower, i+upper] contiguously
+// (width = lower+upper+1 slots per row). Slots falling outside the matrix
+// stay zero. A block-diagonal matrix with block size b is a band (b-1, b-1).
+struct BandMatrix {
+    int rows = 0, cols = 0;
+    int lower = 0, upper = 0;
+    vector<double> data;
+};
+
+inline int band_width(const BandMatrix& X) { return X.lower + X.upper + 1; }
+
+// First/last stored column of row i (clipped to the matrix).
+inline int band_first(const BandMatrix& X, int i) { return max(0, i - X.lower); }
+inline int band_last(const BandMatrix& X, int i)  { return min(X.cols - 1, i + X.upper); }
+
+inline double getBand(const BandMatrix& X, int i, int j)
+{
+    if (j < i - X.lower || j > i + X.upper) return 0.0;
+    return X.data[(size_t)i * band_width(X) + (j - i + X.lower)];
+}
+// Caller guarantees (i,j) lies inside the band.
+inline double& refBand(BandMatrix& X, int i, int j)
+{
+    return X.data[(size_t)i * band_width(X) + (j - i + X.lower)];
+}
+
+BandMatrix make_band(int rows, int cols, int lower, int upper)
+{
+    BandMatrix X;
+    X.rows = rows;
+    X.cols = cols;
+    X.lower = max(0, min(lower, rows - 1));
+    X.upper = max(0, min(upper, cols - 1));
+    X.data.assign((size_t)rows * band_width(X), 0.0);
+    return X;
+}
+
+// Block-diagonal n x n matrix (blocks of size `block`, last one may be short),
+// stored as a band. Entries are 1,2,3,... or uniform(-1,1) with use_random.
+BandMatrix make_block_diagonal(int n, int block, bool use_random, uint64_t seed)
+{
+    BandMatrix X = make_band(n, n, block - 1, block - 1);
+    mt19937_64 rng(seed);
+    uniform_real_distribution<double> dist(-1.0, 1.0);
+    double next = 1.0;
+    for (int i = 0; i < n; ++i) {
+        int b0 = (i / block) * block;
+        int b1 = min(n, b0 + block) - 1;
+        for (int j = b0; j <= b1; ++j) {
+            refBand(X, i, j) = use_random ? dist(rng) : next++;
+        }
+    }
+    return X;
+}
+
+BandMatrix make_band_filled(int n, int lower, int upper, bool use_random, uint64_t seed)
+{
+    BandMatrix X = make_band(n, n, lower, upper);
+    mt19937_64 rng(seed);
+    uniform_real_distribution<double> dist(-1.0, 1.0);
+    double next = 1.0;
+    for (int i = 0; i < n; ++i) {
+        for (int j = band_first(X, i); j <= band_last(X, i); ++j) {
+            refBand(X, i, j) = use_random ? dist(rng) : next++;
+        }
+    }
+    return X;
+}
+
+vector<double> band_to_dense(const BandMatrix& X)
+{
+    vector<double> D((size_t)X.rows * X.cols, 0.0);
+    for (int i = 0; i < X.rows; ++i) {
+        for (int j = band_first(X, i); j <= band_last(X, i); ++j) {
+            D[(size_t)i * X.cols + j] = getBand(X, i, j);
+        }
+    }
+    return D;
+}
+
+// Rows [r0, r1) of C = A*B. Row i of C is a sum of rows k of B scaled by
+// A(i,k), so both operands are walked along their contiguous band rows.
+void band_multiply_rows(const BandMatrix& A, const BandMatrix& B, BandMatrix& C,
+                        int r0, int r1)
+{
+    for (int i = r0; i < r1; ++i) {
+        double* crow = &C.data[(size_t)i * band_width(C)];
+        const int cshift = C.lower - i;
+        for (int k = band_first(A, i); k <= band_last(A, i); ++k) {
+            const double a = getBand(A, i, k);
+            if (a == 0.0) continue;
+            const double* brow = &B.data[(size_t)k * band_width(B)];
+            const int bshift = B.lower - k;
+            const int j0 = band_first(B, k), j1 = band_last(B, k);
+            for (int j = j0; j <= j1; ++j) {
+                crow[j + cshift] += a * brow[j + bshift];
+            }
+        }
+    }
+}
+
+// Split rows so that each thread gets about the same number of multiply-adds;
+// rows near the corners have clipped bands and are cheaper.
+vector<int> split_band_rows(const BandMatrix& A, const BandMatrix& B, int num_threads)
+{
+    vector<double> work(A.rows + 1, 0.0);
+    for (int i = 0; i < A.rows; ++i) {
+        double w = 0.0;
+        for (int k = band_first(A, i); k <= band_last(A, i); ++k) {
+            w += band_last(B, k) - band_first(B, k) + 1;
+        }
+        work[i + 1] = work[i] + w;
+    }
+    vector<int> bounds(num_threads + 1, A.rows);
+    bounds[0] = 0;
+    int i = 0;
+    for (int t = 1; t < num_threads; ++t) {
+        const double target = work[A.rows] * t / num_threads;
+        while (i < A.rows && work[i] < target) ++i;
+        bounds[t] = i;
+    }
+    return bounds;
+}
+
+// C = A*B for banded operands; C has bandwidths (lA+lB, uA+uB), clipped.
+BandMatrix multiply_band(const BandMatrix& A, const BandMatrix& B, WorkerPool& pool)
+{
+    BandMatrix C = make_band(A.rows, B.cols, A.lower + B.lower, A.upper + B.upper);
+    vector<int> bounds = split_band_rows(A, B, pool.size());
+    pool.run([&](int t) { band_multiply_rows(A, B, C, bounds[t], bounds[t + 1]); });
+    return C;
+}
+
+// prog band n lower upper T [--block=b] [--random]
+int run_band(int argc, char** argv)
+{
+    if (argc < 6) {
+        cerr << "Usage: " << argv[0] << " band n lower upper T [--block=b] [--random]\n";
         return 1;
     }
+    const int n = stoi(argv[2]);
+    const int lower = stoi(argv[3]);
+    const int upper = stoi(argv[4]);
+    const int T = max(1, stoi(argv[5]));
 
     bool use_random = false;
+    int block = 0;
     for (int i = 6; i < argc; ++i) {
         string flag = argv[i];
-        if (flag == "--debug") g_debug = true;
-        else if (flag == "--random") use_random = true;
+        if (flag == "--random") use_random = true;
+        else if (flag.rfind("--block=", 0) == 0) block = stoi(flag.substr(8));
         else {
             cerr << "Unknown flag: " << flag << "\n";
             return 1;
         }
     }
 
-    // Allocate A, B, C
-    vector<double> A(M * K), B(K * N), C(M * N, 0.0);
+    BandMatrix A = block > 0 ? make_block_diagonal(n, block, use_random, 42)
+                             : make_band_filled(n, lower, upper, use_random, 42);
+    BandMatrix B = block > 0 ? make_block_diagonal(n, block, use_random, 43)
+                             : make_band_filled(n, lower, upper, use_random, 43);
 
-    // Initialize inputs:
-    // - Default: simple deterministic iota (1,2,3,...) to keep results stable
-    // - Optional: --random to explore cache/branching less deterministically
-    if (use_random) {
-        mt19937_64 rng(42);
-        uniform_real_distribution<double> dist(-1.0, 1.0);
-        for (auto& v : A) v = dist(rng);
-        for (auto& v : B) v = dist(rng);
-    } else {
-        iota(A.begin(), A.end(), 1.0);
-        iota(B.begin(), B.end(), 1.0);
+    WorkerPool pool(T);
+    auto t0 = chrono::high_resolution_clock::now();
+    BandMatrix C = multiply_band(A, B, pool);
+    auto t1 = chrono::high_resolution_clock::now();
+    double band_ms = chrono::duration<double, milli>(t1 - t0).count();
+
+    cout << "Band (n=" << n << ", C band " << C.lower << "/" << C.upper
+         << ", T=" << T << "): " << band_ms << " ms, "
+         << C.data.size() * sizeof(double) / (1024.0 * 1024.0) << " MiB for C\n";
+
+    // Dense cross-check only when it fits comfortably.
+    if (n <= 2048) {
+        vector<double> C_ref = multiply_baseline(band_to_dense(A), band_to_dense(B), n, n, n);
+        cout << "Max |C - C_ref|: " << max_abs_diff(band_to_dense(C), C_ref) << "\n";
     }
+    return 0;
+}
 
-    // Prepare tasks for chosen strategy
-    auto tasks_per_thread = make_tasks(M, N, T, strat);
+// ---------------------------------------------------------------------------
+// Operand structure detection and specialized dispatch
+// ---------------------------------------------------------------------------
 
-    // Time the threaded multiplication (spawn + compute + join)
-    auto t0 = chrono::high_resolution_clock::now();
+// Runs fn(t, r0, r1) on every pool thread over an even split of [0, rows).
+template <class Fn>
+void parallel_rows(int rows, WorkerPool& pool, Fn fn)
+{
+    const int T = pool.size();
+    const int base = rows / T;
+    const int extra = rows % T;
+    pool.run([&](int t) {
+        const int r0 = t * base + min(t, extra);
+        fn(t, r0, r0 + base + (t < extra ? 1 : 0));
+    });
+}
+
+// Compressed sparse rows.
+struct CsrMatrix {
+    int rows = 0, cols = 0;
+    vector<int64_t> row_ptr;   // rows + 1 entries; 64-bit so nnz may exceed INT_MAX
+    vector<int> col_idx;
+    vector<double> val;
+};
+
+// Two passes over the same row split as the structure scan: count each row's
+// nonzeros, prefix-sum the counts into row_ptr, then fill every row in place.
+CsrMatrix dense_to_csr(const vector<double>& X, int rows, int cols, WorkerPool& pool)
+{
+    CsrMatrix S;
+    S.rows = rows;
+    S.cols = cols;
+    S.row_ptr.assign(rows + 1, 0);
+    parallel_rows(rows, pool, [&](int, int r0, int r1) {
+        for (int i = r0; i < r1; ++i) {
+            const double* row = &X[(size_t)i * cols];
+            S.row_ptr[i + 1] = count_if(row, row + cols, [](double v) { return v != 0.0; });
+        }
+    });
+    partial_sum(S.row_ptr.begin(), S.row_ptr.end(), S.row_ptr.begin());
+    S.col_idx.resize(S.row_ptr[rows]);
+    S.val.resize(S.row_ptr[rows]);
+    parallel_rows(rows, pool, [&](int, int r0, int r1) {
+        for (int i = r0; i < r1; ++i) {
+            int64_t p = S.row_ptr[i];
+            for (int j = 0; j < cols; ++j) {
+                const double v = X[(size_t)i * cols + j];
+                if (v == 0.0) continue;
+                S.col_idx[p] = j;
+                S.val[p++] = v;
+            }
+        }
+    });
+    return S;
+}
+
+// What the pre-pass found out about a dense row-major operand.
+struct MatrixStructure {
+    bool identity = false, diagonal = false, permutation = false;
+    bool lower_tri = false, upper_tri = false;
+    bool symmetric = false;           // only checked when asked for
+    int lower_bw = 0, upper_bw = 0;   // observed bandwidths
+    long long nnz = 0;
+    double density = 0.0;
+    vector<int> perm;                 // permutation: column of the 1 in row i
+};
+
+// One parallel pass over the rows; each thread keeps its own partial result
+// and the partials are merged at the end. The symmetry test touches the
+// transpose, so it is only run where a kernel can use it (the B operand).
+MatrixStructure detect_structure(const vector<double>& X, int rows, int cols, WorkerPool& pool,
+                                 bool check_symmetry = false)
+{
+    const int num_threads = pool.size();
+    struct Partial {
+        int lower_bw = 0, upper_bw = 0;
+        long long nnz = 0;
+        bool symmetric = true, unit_rows = true, unit_diag = true;
+    };
+    const bool square = rows == cols;
+    vector<Partial> parts(num_threads);
+    vector<int> one_col(rows, -1);
+
+    parallel_rows(rows, pool, [&](int t, int r0, int r1) {
+        Partial p;
+        p.symmetric = square && check_symmetry;
+        for (int i = r0; i < r1; ++i) {
+            const double* row = &X[(size_t)i * cols];
+            int row_nnz = 0;
+            for (int j = 0; j < cols; ++j) {
+                if (row[j] == 0.0) continue;
+                ++row_nnz;
+                if (j < i) p.lower_bw = max(p.lower_bw, i - j);
+                if (j > i) p.upper_bw = max(p.upper_bw, j - i);
+                if (row[j] == 1.0) one_col[i] = j;
+                else p.unit_rows = false;
+            }
+            if (row_nnz != 1) p.unit_rows = false;
+            if (i >= cols || row[i] != 1.0) p.unit_diag = false;
+            p.nnz += row_nnz;
+            // Only the upper triangle needs comparing; stop once disproved.
+            for (int j = i + 1; p.symmetric && j < cols; ++j) {
+                if (row[j] != X[(size_t)j * cols + i]) p.symmetric = false;
+            }
+        }
+        parts[t] = p;
+    });
 
-    vector<thread> threads;
-    threads.reserve(T);
-    for (int t = 0; t < T; ++t) {
-        threads.emplace_back(worker, t, cref(tasks_per_thread[t]),
-                             cref(A), cref(B), ref(C), M, K, N);
+    MatrixStructure s;
+    bool unit_rows = true, unit_diag = square;
+    s.symmetric = square && check_symmetry;
+    for (const auto& p : parts) {
+        s.lower_bw = max(s.lower_bw, p.lower_bw);
+        s.upper_bw = max(s.upper_bw, p.upper_bw);
+        s.nnz += p.nnz;
+        s.symmetric = s.symmetric && p.symmetric;
+        unit_rows = unit_rows && p.unit_rows;
+        unit_diag = unit_diag && p.unit_diag;
     }
-    for (auto& th : threads) th.join();
+    s.density = rows && cols ? (double)s.nnz / ((double)rows * cols) : 0.0;
+    s.diagonal = square && s.lower_bw == 0 && s.upper_bw == 0;
+    s.identity = s.diagonal && unit_diag && s.nnz == rows;
+    s.lower_tri = square && s.upper_bw == 0;
+    s.upper_tri = square && s.lower_bw == 0;
 
-    auto t1 = chrono::high_resolution_clock::now();
-    double threaded_ms = chrono::duration<double, milli>(t1 - t0).count();
+    if (square && unit_rows) {
+        vector<char> seen(cols, 0);
+        s.permutation = true;
+        for (int i = 0; i < rows && s.permutation; ++i) {
+            if (seen[one_col[i]]) s.permutation = false;
+            seen[one_col[i]] = 1;
+        }
+        if (s.permutation) s.perm = one_col;
+    }
+    return s;
+}
 
-    cout << "Threaded (" << sarg << ", T=" << T << "): " << threaded_ms << " ms\n";
+string describe_structure(const MatrixStructure& s)
+{
+    if (s.identity)    return "identity";
+    if (s.permutation) return "permutation";
+    if (s.diagonal)    return "diagonal";
+    string d;
+    if (s.lower_tri) d += "lower-triangular ";
+    if (s.upper_tri) d += "upper-triangular ";
+    if (s.symmetric) d += "symmetric ";
+    d += "band " + to_string(s.lower_bw) + "/" + to_string(s.upper_bw);
+    d += ", density " + to_string(s.density);
+    return d;
+}
 
-    // Baseline single-thread timing + correctness check
-    auto b0 = chrono::high_resolution_clock::now();
-    vector<double> C_ref = multiply_baseline(A, B, M, K, N);
-    auto b1 = chrono::high_resolution_clock::now();
-    double baseline_ms = chrono::duration<double, milli>(b1 - b0).count();
+// Density below which the CSR row-axpy kernel beats the dense dot product.
+static const double kSparseDensity = 0.10;
 
-    double diff = max_abs_diff(C, C_ref);
-    cout << "Baseline (1 thread): " << baseline_ms << " ms\n";
-    cout << "Max |C - C_ref|: " << diff << "\n";
+// C = A*B where A is sparse: row i of C accumulates A(i,k) * row k of B.
+void multiply_csr_dense(const CsrMatrix& A, const vector<double>& B, vector<double>& C,
+                        int N, WorkerPool& pool)
+{
+    parallel_rows(A.rows, pool, [&](int, int r0, int r1) {
+        for (int i = r0; i < r1; ++i) {
+            double* crow = &C[(size_t)i * N];
+            fill(crow, crow + N, 0.0);
+            for (int64_t p = A.row_ptr[i]; p < A.row_ptr[i + 1]; ++p) {
+                const double a = A.val[p];
+                const double* brow = &B[(size_t)A.col_idx[p] * N];
+                for (int j = 0; j < N; ++j) crow[j] += a * brow[j];
+            }
+        }
+    });
+}
 
-    // Tiny sanity print for very small matrices (kept compact)
-    if (g_debug && M <= 9 && N <= 9) {
-        cout << "C (threaded) first few rows:\n";
-        for (int i = 0; i < M; ++i) {
+// C = A*B where B is sparse: A(i,k) scatters into the nonzero columns of row k of B.
+void multiply_dense_csr(const vector<double>& A, const CsrMatrix& B, vector<double>& C,
+                        int M, int K, int N, WorkerPool& pool)
+{
+    parallel_rows(M, pool, [&](int, int r0, int r1) {
+        for (int i = r0; i < r1; ++i) {
+            double* crow = &C[(size_t)i * N];
+            fill(crow, crow + N, 0.0);
+            for (int kk = 0; kk < K; ++kk) {
+                const double a = getA(A, i, kk, K);
+                if (a == 0.0) continue;
+                for (int64_t p = B.row_ptr[kk]; p < B.row_ptr[kk + 1]; ++p) {
+                    crow[B.col_idx[p]] += a * B.val[p];
+                }
+            }
+        }
+    });
+}
+
+// Dot products restricted to the k range where both A(i,k) and B(k,j) can be
+// nonzero: k in [i-lA, i+uA] and k in [j-uB, j+lB]. Covers triangular
+// (half the work) and banded operands alike. B symmetric is read by rows.
+void multiply_k_ranged(const vector<double>& A, const vector<double>& B, vector<double>& C,
+                       int M, int K, int N,
+                       int lA, int uA, int lB, int uB, bool b_symmetric, WorkerPool& pool)
+{
+    parallel_rows(M, pool, [&](int, int r0, int r1) {
+        for (int i = r0; i < r1; ++i) {
             for (int j = 0; j < N; ++j) {
-                cout << getC(C, i, j, N) << (j + 1 == N ? '\n' : ' ');
+                const int k0 = max({0, i - lA, j - uB});
+                const int k1 = min({K - 1, i + uA, j + lB});
+                double s = 0.0;
+                if (b_symmetric) {
+                    const double* brow = &B[(size_t)j * N];
+                    for (int kk = k0; kk <= k1; ++kk) s += getA(A, i, kk, K) * brow[kk];
+                } else {
+                    for (int kk = k0; kk <= k1; ++kk) s += getA(A, i, kk, K) * getB(B, kk, j, N);
+                }
+                getC(C, i, j, N) = s;
             }
         }
+    });
+}
+
+// Detects the structure of A and B and runs the cheapest kernel that is exact
+// for it. Returns the name of the path taken, or "" when nothing applies and
+// the caller should use the general kernel.
+string multiply_structured(const vector<double>& A, const vector<double>& B, vector<double>& C,
+                           int M, int K, int N, WorkerPool& pool,
+                           MatrixStructure* outA = nullptr, MatrixStructure* outB = nullptr)
+{
+    MatrixStructure sa = detect_structure(A, M, K, pool);
+    MatrixStructure sb = detect_structure(B, K, N, pool, true);
+    if (outA) *outA = sa;
+    if (outB) *outB = sb;
+
+    if (sa.identity) { C = B; return "copy B (A = I)"; }
+    if (sb.identity) { C = A; return "copy A (B = I)"; }
+
+    if (sa.permutation) {
+        parallel_rows(M, pool, [&](int, int r0, int r1) {
+            for (int i = r0; i < r1; ++i) {
+                copy_n(&B[(size_t)sa.perm[i] * N], N, &C[(size_t)i * N]);
+            }
+        });
+        return "row gather (A permutation)";
     }
-    return 0;
+    if (sb.permutation) {
+        parallel_rows(M, pool, [&](int, int r0, int r1) {
+            for (int i = r0; i < r1; ++i) {
+                for (int kk = 0; kk < K; ++kk) getC(C, i, sb.perm[kk], N) = getA(A, i, kk, K);
+            }
+        });
+        return "column scatter (B permutation)";
+    }
+    if (sa.diagonal) {
+        parallel_rows(M, pool, [&](int, int r0, int r1) {
+            for (int i = r0; i < r1; ++i) {
+                const double d = getA(A, i, i, K);
+                for (int j = 0; j < N; ++j) getC(C, i, j, N) = d * getB(B, i, j, N);
+            }
+        });
+        return "row scaling (A diagonal)";
+    }
+    if (sb.diagonal) {
+        parallel_rows(M, pool, [&](int, int r0, int r1) {
+            for (int i = r0; i < r1; ++i) {
+                for (int j = 0; j < N; ++j) getC(C, i, j, N) = getA(A, i, j, K) * getB(B, j, j, N);
+            }
+        });
+        return "column scaling (B diagonal)";
+    }
+
+    if (sa.density < kSparseDensity && sa.density <= sb.density) {
+        multiply_csr_dense(dense_to_csr(A, M, K, pool), B, C, N, pool);
+        return "sparse A x dense B";
+    }
+    if (sb.density < kSparseDensity) {
+        multiply_dense_csr(A, dense_to_csr(B, K, N, pool), C, M, K, N, pool);
+        return "dense A x sparse B";
+    }
+
+    // Fraction of the full K loop that the ranged kernel still has to run;
+    // only worth it if a meaningful share of the work disappears.
+    auto kept = [K](int lo, int up) {
+        double w = 0.0;
+        for (int i = 0; i < K; ++i) w += min(K - 1, i + up) - max(0, i - lo) + 1;
+        return w / ((double)K * K);
+    };
+    const bool square_a = M == K, square_b = K == N;
+    const int lA = square_a ? sa.lower_bw : K, uA = square_a ? sa.upper_bw : K;
+    const int lB = square_b ? sb.lower_bw : K, uB = square_b ? sb.upper_bw : K;
+    const double frac = min(square_a ? kept(lA, uA) : 1.0, square_b ? kept(uB, lB) : 1.0);
+    if (frac < 0.75 || sb.symmetric) {
+        multiply_k_ranged(A, B, C, M, K, N, lA, uA, lB, uB, sb.symmetric, pool);
+        if (frac < 0.75) return "k-ranged (triangular/banded, " + to_string((int)(100 * frac)) + "% of k)";
+        return "row-read (B symmetric)";
+    }
+    return "";
 }
 
-/*
-build command:
-g++ -O2 -std=c++17 -pthread matrix_threads.cpp -o mtmul.exe
+// Zeroes / overwrites X so it takes the requested shape (for --shapeA/--shapeB).
+bool apply_shape(vector<double>& X, int rows, int cols, const string& kind, uint64_t seed)
+{
+    mt19937_64 rng(seed);
+    auto at = [&](int i, int j) -> double& { return X[(size_t)i * cols + j]; };
+    if (kind == "dense") return true;
+    if (kind == "identity" || kind == "diagonal" || kind == "perm") {
+        vector<int> perm(rows);
+        iota(perm.begin(), perm.end(), 0);
+        if (kind == "perm") shuffle(perm.begin(), perm.end(), rng);
+        for (int i = 0; i < rows; ++i) {
+            for (int j = 0; j < cols; ++j) {
+                bool keep = kind == "perm" ? j == perm[i] : j == i;
+                if (!keep) at(i, j) = 0.0;
+                else if (kind != "diagonal") at(i, j) = 1.0;
+            }
+        }
+        return rows == cols;
+    }
+    if (kind == "lower" || kind == "upper" || kind == "sym" || kind == "band") {
+        for (int i = 0; i < rows; ++i) {
+            for (int j = 0; j < cols; ++j) {
+                if (kind == "lower" && j > i) at(i, j) = 0.0;
+                if (kind == "upper" && j < i) at(i, j) = 0.0;
+                if (kind == "band" && abs(i - j) > 8) at(i, j) = 0.0;
+                if (kind == "sym" && j > i) at(i, j) = at(j, i);
+            }
+        }
+        return rows == cols;
+    }
+    if (kind == "sparse") {
+        uniform_real_distribution<double> u(0.0, 1.0);
+        for (auto& v : X) if (u(rng) > 0.02) v = 0.0;
+        return true;
+    }
+    return false;
+}
 
+// ---------------------------------------------------------------------------
+// Transpose and layout conversion
+// ---------------------------------------------------------------------------
 
-examples to run:
+// Cache-oblivious transpose of the block [r0,r1) x [c0,c1) of a row-major
+// rows x cols matrix into dst (cols x rows): halve the longer side until the
+// block fits in L1, so both source and destination lines get reused.
+void transpose_rec(const double* src, double* dst, int rows, int cols,
+                   int r0, int r1, int c0, int c1)
+{
+    const int dr = r1 - r0, dc = c1 - c0;
+    if ((long long)dr * dc <= 32 * 32) {
+        for (int i = r0; i < r1; ++i) {
+            for (int j = c0; j < c1; ++j) {
+                dst[(size_t)j * rows + i] = src[(size_t)i * cols + j];
+            }
+        }
+    } else if (dr >= dc) {
+        const int rm = r0 + dr / 2;
+        transpose_rec(src, dst, rows, cols, r0, rm, c0, c1);
+        transpose_rec(src, dst, rows, cols, rm, r1, c0, c1);
+    } else {
+        const int cm = c0 + dc / 2;
+        transpose_rec(src, dst, rows, cols, r0, r1, c0, cm);
+        transpose_rec(src, dst, rows, cols, r0, r1, cm, c1);
+    }
+}
 
-small debug test:
-./mtmul.exe 9 9 9 4 rows --debug 
+// dst = src^T for a row-major rows x cols src. Threads take disjoint row
+// bands of src (disjoint column bands of dst), so no synchronization needed.
+vector<double> transpose_parallel(const vector<double>& src, int rows, int cols, WorkerPool& pool)
+{
+    vector<double> dst((size_t)rows * cols);
+    parallel_rows(rows, pool, [&](int, int r0, int r1) {
+        transpose_rec(src.data(), dst.data(), rows, cols, r0, r1, 0, cols);
+    });
+    return dst;
+}
+
+// Converts a rows x cols matrix between layouts. A column-major matrix has
+// the same memory image as the row-major transpose, so this is a transpose.
+vector<double> convert_layout(const vector<double>& src, int rows, int cols,
+                              Layout from, Layout to, WorkerPool& pool)
+{
+    if (from == to) return src;
+    if (from == Layout::RowMajor) return transpose_parallel(src, rows, cols, pool);
+    return transpose_parallel(src, cols, rows, pool);
+}
+
+// ---------------------------------------------------------------------------
+// Tiles and grouped GEMM
+// ---------------------------------------------------------------------------
+
+// One independent product C = A*B (row-major, C preallocated to M*N).
+struct GemmProblem {
+    const vector<double>* A = nullptr;
+    const vector<double>* B = nullptr;
+    vector<double>* C = nullptr;
+    int M = 0, K = 0, N = 0;
+};
+
+// A block of C: rows [i0,i1) x cols [j0,j1) of problem `problem`.
+struct Tile {
+    int problem = 0;
+    int i0 = 0, i1 = 0, j0 = 0, j1 = 0;
+};
+
+static const int kTileSize = 64;
+
+// C = A * B for a rows x cols block with explicit leading dimensions (A is
+// rows x K, B is K x cols, C is rows x cols), i-k-j so the inner loop streams
+// a row segment of B and of C. C may be a slice of a larger matrix or a
+// caller-owned tile buffer.
+void compute_block(const double* A, int lda, const double* B, int ldb, double* C, int ldc,
+                   int rows, int cols, int K)
+{
+    for (int i = 0; i < rows; ++i) {
+        double* crow = C + (size_t)i * ldc;
+        const double* arow = A + (size_t)i * lda;
+        fill(crow, crow + cols, 0.0);
+        for (int kk = 0; kk < K; ++kk) {
+            const double a = arow[kk];
+            const double* brow = B + (size_t)kk * ldb;
+            for (int j = 0; j < cols; ++j) crow[j] += a * brow[j];
+        }
+    }
+}
+
+// Computes C[i0:i1, j0:j1] = A[i0:i1, :] * B[:, j0:j1].
+void compute_tile(const vector<double>& A, const vector<double>& B, vector<double>& C,
+                  int K, int N, const Tile& t)
+{
+    compute_block(&A[(size_t)t.i0 * K], K, &B[t.j0], N, &C[(size_t)t.i0 * N + t.j0], N,
+                  t.i1 - t.i0, t.j1 - t.j0, K);
+}
+
+// compute_tile in the reproducible order (see dot_repro): each K chunk of the
+// tile is accumulated into its own partial tile from zero, and partial tiles
+// are merged elementwise with the same pairwise tree. scratch must hold
+// (kPairwiseLevels + 1) tiles.
+static const int kPairwiseLevels = 40;
+
+void compute_tile_repro(const vector<double>& A, const double* B, vector<double>& C,
+                        int K, int N, const Tile& t, double* scratch)
+{
+    const int w = t.j1 - t.j0;
+    const size_t elems = (size_t)(t.i1 - t.i0) * w;
+    int level[kPairwiseLevels + 1];
+    int n = 0;
+    for (int k0 = 0; k0 < K; k0 += kReproChunk) {
+        const int k1 = min(K, k0 + kReproChunk);
+        double* cur = scratch + n * elems;
+        fill(cur, cur + elems, 0.0);
+        for (int i = t.i0; i < t.i1; ++i) {
+            double* crow = cur + (size_t)(i - t.i0) * w;
+            for (int kk = k0; kk < k1; ++kk) {
+                const double a = getA(A, i, kk, K);
+                const double* brow = &B[(size_t)kk * N + t.j0];
+                for (int j = 0; j < w; ++j) crow[j] += a * brow[j];
+            }
+        }
+        level[n++] = 0;
+        while (n >= 2 && level[n - 1] == level[n - 2]) {
+            double* older = scratch + (n - 2) * elems;
+            const double* newer = scratch + (n - 1) * elems;
+            for (size_t e = 0; e < elems; ++e) older[e] = older[e] + newer[e];
+            ++level[n - 2];
+            --n;
+        }
+    }
+    for (int i = t.i0; i < t.i1; ++i) {
+        for (int j = 0; j < w; ++j) {
+            const size_t e = (size_t)(i - t.i0) * w + j;
+            double acc = n > 0 ? scratch[(n - 1) * elems + e] : 0.0;
+            for (int sl = n - 2; sl >= 0; --sl) acc = scratch[sl * elems + e] + acc;
+            C[(size_t)i * N + t.j0 + j] = acc;
+        }
+    }
+}
+
+// Tile kernel selected by the context's options (thread t's scratch is used
+// in reproducible mode). B is a raw K x N array so callers may pass a private
+// copy that is not a vector.
+void compute_tile_ctx(EngineContext& ctx, int t, const vector<double>& A, const double* B,
+                      vector<double>& C, int K, int N, const Tile& tl)
+{
+    PhaseScope phase(kPhaseKernel, ctx.opts.reproducible ? kKernelTileRepro : kKernelTile);
+    const auto k0 = ctx.metrics ? chrono::steady_clock::now() : chrono::steady_clock::time_point();
+    if (!ctx.opts.reproducible) {
+        compute_block(&A[(size_t)tl.i0 * K], K, B + tl.j0, N, &C[(size_t)tl.i0 * N + tl.j0], N,
+                      tl.i1 - tl.i0, tl.j1 - tl.j0, K);
+    } else {
+        const size_t elems = (size_t)(tl.i1 - tl.i0) * (tl.j1 - tl.j0);
+        compute_tile_repro(A, B, C, K, N, tl, ctx.scratch_for(t, elems * (kPairwiseLevels + 1)));
+    }
+    if (ctx.metrics) {
+        ctx.metrics->observe_kernel(t, ctx.opts.reproducible ? kKernelTileRepro : kKernelTile, ns_since(k0));
+    }
+}
+
+// Cuts an M x N product into tile x tile blocks (edge tiles are smaller).
+void append_tiles(vector<Tile>& out, int problem, int M, int N, int tile)
+{
+    for (int i0 = 0; i0 < M; i0 += tile) {
+        for (int j0 = 0; j0 < N; j0 += tile) {
+            out.push_back({problem, i0, min(M, i0 + tile), j0, min(N, j0 + tile)});
+        }
+    }
+}
+
+// Runs every problem of the group on one set of T threads. All tiles go into
+// a single list ordered by cost (largest first) and threads claim them from a
+// shared counter, so a thread that finishes one problem's tiles moves straight
+// on to another's instead of waiting at a per-problem join.
+void multiply_grouped(vector<GemmProblem>& group, WorkerPool& pool, int tile = kTileSize)
+{
+    vector<Tile> tiles;
+    for (int p = 0; p < (int)group.size(); ++p) {
+        append_tiles(tiles, p, group[p].M, group[p].N, tile);
+    }
+    auto cost = [&](const Tile& t) {
+        return (double)(t.i1 - t.i0) * (t.j1 - t.j0) * group[t.problem].K;
+    };
+    stable_sort(tiles.begin(), tiles.end(),
+                [&](const Tile& a, const Tile& b) { return cost(a) > cost(b); });
+
+    atomic<size_t> next{0};
+    pool.run([&](int) {
+        for (size_t idx; (idx = next.fetch_add(1, memory_order_relaxed)) < tiles.size();) {
+            const Tile& tl = tiles[idx];
+            const GemmProblem& g = group[tl.problem];
+            compute_tile(*g.A, *g.B, *g.C, g.K, g.N, tl);
+        }
+    });
+}
+
+// prog group count T [--random]
+int run_group(int argc, char** argv)
+{
+    if (argc < 4) {
+        cerr << "Usage: " << argv[0] << " group count T [--random]\n";
+        return 1;
+    }
+    const int count = stoi(argv[2]);
+    const int T = max(1, stoi(argv[3]));
+    bool use_random = false;
+    for (int i = 4; i < argc; ++i) {
+        string flag = argv[i];
+        if (flag == "--random") use_random = true;
+        else {
+            cerr << "Unknown flag: " << flag << "\n";
+            return 1;
+        }
+    }
+
+    // Mixed shapes between 16 and 512 per dimension.
+    mt19937_64 rng(42);
+    uniform_int_distribution<int> dim(16, 512);
+    uniform_real_distribution<double> dist(-1.0, 1.0);
+    vector<vector<double>> As(count), Bs(count), Cs(count), Cs_seq(count);
+    vector<GemmProblem> group(count);
+    double flops = 0.0;
+    for (int p = 0; p < count; ++p) {
+        int M = dim(rng), K = dim(rng), N = dim(rng);
+        As[p].resize((size_t)M * K);
+        Bs[p].resize((size_t)K * N);
+        if (use_random) {
+            for (auto& v : As[p]) v = dist(rng);
+            for (auto& v : Bs[p]) v = dist(rng);
+        } else {
+            iota(As[p].begin(), As[p].end(), 1.0);
+            iota(Bs[p].begin(), Bs[p].end(), 1.0);
+        }
+        Cs[p].assign((size_t)M * N, 0.0);
+        Cs_seq[p].assign((size_t)M * N, 0.0);
+        group[p] = {&As[p], &Bs[p], &Cs[p], M, K, N};
+        flops += 2.0 * M * K * N;
+    }
+
+    WorkerPool pool(T);
+    auto t0 = chrono::high_resolution_clock::now();
+    multiply_grouped(group, pool);
+    auto t1 = chrono::high_resolution_clock::now();
+    double grouped_ms = chrono::duration<double, milli>(t1 - t0).count();
+
+    // Same work issued one problem at a time, each with its own spawn/join.
+    auto s0 = chrono::high_resolution_clock::now();
+    for (int p = 0; p < count; ++p) {
+        vector<GemmProblem> one{{&As[p], &Bs[p], &Cs_seq[p], group[p].M, group[p].K, group[p].N}};
+        multiply_grouped(one, pool);
+    }
+    auto s1 = chrono::high_resolution_clock::now();
+    double seq_ms = chrono::duration<double, milli>(s1 - s0).count();
+
+    double diff = 0.0;
+    for (int p = 0; p < count; ++p) {
+        const auto& g = group[p];
+        diff = max(diff, max_abs_diff(Cs[p], multiply_baseline(As[p], Bs[p], g.M, g.K, g.N)));
+        diff = max(diff, max_abs_diff(Cs[p], Cs_seq[p]));
+    }
+
+    cout << "Grouped (" << count << " problems, T=" << T << "): " << grouped_ms << " ms, "
+         << flops / (grouped_ms * 1e6) << " GFLOP/s\n";
+    cout << "One by one (T=" << T << "): " << seq_ms << " ms, "
+         << flops / (seq_ms * 1e6) << " GFLOP/s\n";
+    cout << "Max |C - C_ref|: " << diff << "\n";
+    return 0;
+}
+
+// ---------------------------------------------------------------------------
+// Pairwise distances via GEMM
+// ---------------------------------------------------------------------------
+
+enum class Metric { Euclidean, Cosine };
+
+// Surviving entry of a thresholded distance matrix.
+struct DistEntry {
+    int i, j;
+    double value;
+};
+
+// Distances between rows of X (n x d) and rows of Y (m x d). The cross term
+// X*Y^T goes through the GEMM tile kernel (compute_block) against Y^T, which
+// is transposed once; squared norms are computed once and applied in the
+// tile epilogue:
+//   Euclidean: sqrt(max(0, |x|^2 + |y|^2 - 2 x.y))
+//   Cosine:    x.y / (|x| |y|)   (similarity; 0 for a zero vector)
+// Without a threshold D (n x m) is filled. With one, D is left untouched and
+// only entries with distance <= threshold (Euclidean) or similarity >=
+// threshold (Cosine) are returned; each thread's tile lands in its own
+// kTileSize^2 buffer, so the dense result is never written.
+vector<DistEntry> pairwise_distances(const vector<double>& X, const vector<double>& Y,
+                                     int n, int m, int d, Metric metric, WorkerPool& pool,
+                                     vector<double>* D, const double* threshold = nullptr)
+{
+    const int num_threads = pool.size();
+    vector<double> nx(n), ny(m);
+    auto sq_norms = [&](const vector<double>& Z, vector<double>& out, int rows) {
+        parallel_rows(rows, pool, [&](int, int r0, int r1) {
+            for (int i = r0; i < r1; ++i) {
+                const double* z = &Z[(size_t)i * d];
+                double s = 0.0;
+                for (int k = 0; k < d; ++k) s += z[k] * z[k];
+                out[i] = s;
+            }
+        });
+    };
+    sq_norms(X, nx, n);
+    sq_norms(Y, ny, m);
+    const vector<double> Yt = transpose_parallel(Y, m, d, pool);
+
+    vector<Tile> tiles;
+    append_tiles(tiles, 0, n, m, kTileSize);
+    vector<vector<DistEntry>> found(num_threads);
+
+    atomic<size_t> next{0};
+    pool.run([&](int t) {
+        vector<double> buf;
+        if (threshold) buf.resize((size_t)kTileSize * kTileSize);
+        for (size_t idx; (idx = next.fetch_add(1, memory_order_relaxed)) < tiles.size();) {
+            const Tile& tl = tiles[idx];
+            const int rows = tl.i1 - tl.i0, cols = tl.j1 - tl.j0;
+            // Dot products straight into D, or into the tile buffer.
+            double* dots = threshold ? buf.data() : &(*D)[(size_t)tl.i0 * m + tl.j0];
+            const int ldc = threshold ? cols : m;
+            compute_block(&X[(size_t)tl.i0 * d], d, &Yt[tl.j0], m, dots, ldc, rows, cols, d);
+
+            for (int r = 0; r < rows; ++r) {
+                const int i = tl.i0 + r;
+                double* row = dots + (size_t)r * ldc;
+                for (int c = 0; c < cols; ++c) {
+                    const int j = tl.j0 + c;
+                    double v;
+                    if (metric == Metric::Euclidean) {
+                        v = sqrt(max(0.0, nx[i] + ny[j] - 2.0 * row[c]));
+                    } else {
+                        double den = sqrt(nx[i] * ny[j]);
+                        v = den > 0.0 ? row[c] / den : 0.0;
+                    }
+
+                    if (!threshold) {
+                        row[c] = v;
+                    } else if (metric == Metric::Euclidean ? v <= *threshold : v >= *threshold) {
+                        found[t].push_back({i, j, v});
+                    }
+                }
+            }
+        }
+    });
+
+    vector<DistEntry> out;
+    for (auto& f : found) out.insert(out.end(), f.begin(), f.end());
+    sort(out.begin(), out.end(), [](const DistEntry& a, const DistEntry& b) {
+        return a.i != b.i ? a.i < b.i : a.j < b.j;
+    });
+    return out;
+}
+
+// Direct (x-y) formulation for checking.
+double reference_distance(const double* x, const double* y, int d, Metric metric)
+{
+    if (metric == Metric::Euclidean) {
+        double s = 0.0;
+        for (int k = 0; k < d; ++k) s += (x[k] - y[k]) * (x[k] - y[k]);
+        return sqrt(s);
+    }
+    double dot = 0.0, a = 0.0, b = 0.0;
+    for (int k = 0; k < d; ++k) {
+        dot += x[k] * y[k];
+        a += x[k] * x[k];
+        b += y[k] * y[k];
+    }
+    return a > 0.0 && b > 0.0 ? dot / sqrt(a * b) : 0.0;
+}
+
+// prog pdist n m d T euclid|cosine [--threshold=x]
+int run_pdist(int argc, char** argv)
+{
+    if (argc < 7) {
+        cerr << "Usage: " << argv[0] << " pdist n m d T euclid|cosine [--threshold=x]\n";
+        return 1;
+    }
+    const int n = stoi(argv[2]);
+    const int m = stoi(argv[3]);
+    const int d = stoi(argv[4]);
+    const int T = max(1, stoi(argv[5]));
+    string marg = argv[6];
+    Metric metric = Metric::Euclidean;
+    if (marg == "cosine") metric = Metric::Cosine;
+    else if (marg != "euclid") {
+        cerr << "Unknown metric: " << marg << " (use euclid|cosine)\n";
+        return 1;
+    }
+    bool has_threshold = false;
+    double threshold = 0.0;
+    for (int i = 7; i < argc; ++i) {
+        string flag = argv[i];
+        if (flag.rfind("--threshold=", 0) == 0) {
+            has_threshold = true;
+            threshold = stod(flag.substr(12));
+        } else {
+            cerr << "Unknown flag: " << flag << "\n";
+            return 1;
+        }
+    }
+
+    mt19937_64 rng(42);
+    uniform_real_distribution<double> dist(-1.0, 1.0);
+    vector<double> X((size_t)n * d), Y((size_t)m * d);
+    for (auto& v : X) v = dist(rng);
+    for (auto& v : Y) v = dist(rng);
+
+    vector<double> D;
+    if (!has_threshold) D.assign((size_t)n * m, 0.0);
+
+    WorkerPool pool(T);
+    auto t0 = chrono::high_resolution_clock::now();
+    vector<DistEntry> hits = pairwise_distances(X, Y, n, m, d, metric, pool, &D,
+                                                has_threshold ? &threshold : nullptr);
+    auto t1 = chrono::high_resolution_clock::now();
+    double ms = chrono::duration<double, milli>(t1 - t0).count();
+
+    cout << "Pairwise " << marg << " (" << n << "x" << m << ", d=" << d << ", T=" << T << "): "
+         << ms << " ms\n";
+    if (has_threshold) cout << "Entries within threshold: " << hits.size() << "\n";
+
+    // Spot-check against the direct formula on a sample of pairs.
+    double diff = 0.0;
+    size_t expected = 0;
+    const bool full_check = (double)n * m <= 4e6;
+    for (int i = 0; i < n; ++i) {
+        for (int j = 0; j < m; ++j) {
+            if (!full_check && (i * 31 + j) % 97 != 0) continue;
+            double ref = reference_distance(&X[(size_t)i * d], &Y[(size_t)j * d], d, metric);
+            if (!has_threshold) diff = max(diff, abs(D[(size_t)i * m + j] - ref));
+            else if (metric == Metric::Euclidean ? ref <= threshold : ref >= threshold) ++expected;
+        }
+    }
+    if (!has_threshold) cout << "Max |D - D_ref|: " << diff << "\n";
+    else if (full_check) cout << "Expected entries (direct formula): " << expected << "\n";
+    return 0;
+}
+
+// ---------------------------------------------------------------------------
+// Masked sparse-sparse multiply and graph drivers
+// ---------------------------------------------------------------------------
+
+CsrMatrix csr_transpose(const CsrMatrix& X)
+{
+    CsrMatrix Y;
+    Y.rows = X.cols;
+    Y.cols = X.rows;
+    Y.row_ptr.assign(Y.rows + 1, 0);
+    for (int c : X.col_idx) ++Y.row_ptr[c + 1];
+    for (int r = 0; r < Y.rows; ++r) Y.row_ptr[r + 1] += Y.row_ptr[r];
+    Y.col_idx.resize(X.col_idx.size());
+    Y.val.resize(X.val.size());
+    vector<int64_t> pos(Y.row_ptr.begin(), Y.row_ptr.end() - 1);
+    for (int i = 0; i < X.rows; ++i) {
+        for (int64_t p = X.row_ptr[i]; p < X.row_ptr[i + 1]; ++p) {
+            const int64_t q = pos[X.col_idx[p]]++;
+            Y.col_idx[q] = i;
+            Y.val[q] = X.val[p];
+        }
+    }
+    return Y;
+}
+
+// Which kernel each row of a masked multiply used (for reporting).
+struct MaskedStats {
+    long long dot_rows = 0, gustavson_rows = 0;
+};
+
+// C = (A*B) .* M with a structural mask: C(i,j) is computed only where M has
+// an entry; entries whose sum is exactly zero are dropped. Per row, the cheaper
+// of two kernels is chosen from nonzero counts:
+//   masked dot:       for each (i,j) in M, merge row i of A with column j of B
+//                     (cost ~ sum_j nnz(A(i,:)) + nnz(B(:,j)))
+//   masked Gustavson: scatter A(i,k)*B(k,:) into an accumulator, keeping only
+//                     columns flagged by row i of M (cost ~ sum_k nnz(B(k,:)))
+// Rows are handed out dynamically in chunks; per-thread scratch is O(cols).
+CsrMatrix masked_spgemm(const CsrMatrix& A, const CsrMatrix& B, const CsrMatrix& M,
+                        WorkerPool& pool, MaskedStats* stats = nullptr)
+{
+    const CsrMatrix Bt = csr_transpose(B);   // columns of B as rows
+    const size_t mask_nnz = M.col_idx.size();
+    vector<double> value(mask_nnz, 0.0);
+    vector<char> present(mask_nnz, 0);
+
+    const int chunk = 64;
+    atomic<int> next{0};
+    atomic<long long> dot_rows{0}, gus_rows{0};
+    pool.run([&](int) {
+        vector<int64_t> mark(B.cols, -1);     // mask position of column j in this row
+        vector<double> acc(B.cols, 0.0);
+        vector<char> hit(B.cols, 0);
+        long long my_dot = 0, my_gus = 0;
+
+        for (int r0; (r0 = next.fetch_add(chunk, memory_order_relaxed)) < M.rows;) {
+            for (int i = r0; i < min(M.rows, r0 + chunk); ++i) {
+                const int64_t m0 = M.row_ptr[i], m1 = M.row_ptr[i + 1];
+                const int64_t a0 = A.row_ptr[i], a1 = A.row_ptr[i + 1];
+                if (m0 == m1 || a0 == a1) continue;
+
+                double dot_cost = 0.0, gus_cost = m1 - m0;
+                for (int64_t p = m0; p < m1; ++p) {
+                    int j = M.col_idx[p];
+                    dot_cost += (a1 - a0) + (Bt.row_ptr[j + 1] - Bt.row_ptr[j]);
+                }
+                for (int64_t p = a0; p < a1; ++p) {
+                    int k = A.col_idx[p];
+                    gus_cost += B.row_ptr[k + 1] - B.row_ptr[k];
+                }
+
+                if (dot_cost <= gus_cost) {
+                    ++my_dot;
+                    for (int64_t p = m0; p < m1; ++p) {
+                        const int j = M.col_idx[p];
+                        int64_t x = a0, y = Bt.row_ptr[j];
+                        const int64_t y1 = Bt.row_ptr[j + 1];
+                        double s = 0.0;
+                        bool any = false;
+                        while (x < a1 && y < y1) {
+                            if (A.col_idx[x] < Bt.col_idx[y]) ++x;
+                            else if (A.col_idx[x] > Bt.col_idx[y]) ++y;
+                            else {
+                                s += A.val[x++] * Bt.val[y++];
+                                any = true;
+                            }
+                        }
+                        if (any && s != 0.0) {
+                            value[p] = s;
+                            present[p] = 1;
+                        }
+                    }
+                } else {
+                    ++my_gus;
+                    for (int64_t p = m0; p < m1; ++p) mark[M.col_idx[p]] = p;
+                    for (int64_t p = a0; p < a1; ++p) {
+                        const int k = A.col_idx[p];
+                        const double a = A.val[p];
+                        for (int64_t q = B.row_ptr[k]; q < B.row_ptr[k + 1]; ++q) {
+                            const int j = B.col_idx[q];
+                            if (mark[j] < 0) continue;   // not in row i of M
+                            acc[j] += a * B.val[q];
+                            hit[j] = 1;
+                        }
+                    }
+                    for (int64_t p = m0; p < m1; ++p) {
+                        const int j = M.col_idx[p];
+                        if (hit[j] && acc[j] != 0.0) {
+                            value[p] = acc[j];
+                            present[p] = 1;
+                        }
+                        acc[j] = 0.0;
+                        hit[j] = 0;
+                        mark[j] = -1;
+                    }
+                }
+            }
+        }
+        dot_rows += my_dot;
+        gus_rows += my_gus;
+    });
+
+    // Compact the mask-aligned values into C.
+    CsrMatrix C;
+    C.rows = M.rows;
+    C.cols = M.cols;
+    C.row_ptr.assign(M.rows + 1, 0);
+    for (int i = 0; i < M.rows; ++i) {
+        for (int64_t p = M.row_ptr[i]; p < M.row_ptr[i + 1]; ++p) {
+            if (!present[p]) continue;
+            C.col_idx.push_back(M.col_idx[p]);
+            C.val.push_back(value[p]);
+        }
+        C.row_ptr[i + 1] = (int64_t)C.col_idx.size();
+    }
+    if (stats) {
+        stats->dot_rows = dot_rows;
+        stats->gustavson_rows = gus_rows;
+    }
+    return C;
+}
+
+// Symmetric 0/1 adjacency matrix from undirected edges (self loops and
+// duplicates removed, columns sorted).
+CsrMatrix adjacency_from_edges(int n, const vector<pair<int,int>>& edges)
+{
+    vector<vector<int>> nbr(n);
+    for (auto [u, v] : edges) {
+        if (u == v) continue;
+        nbr[u].push_back(v);
+        nbr[v].push_back(u);
+    }
+    CsrMatrix G;
+    G.rows = G.cols = n;
+    G.row_ptr.assign(n + 1, 0);
+    for (int i = 0; i < n; ++i) {
+        sort(nbr[i].begin(), nbr[i].end());
+        nbr[i].erase(unique(nbr[i].begin(), nbr[i].end()), nbr[i].end());
+        G.col_idx.insert(G.col_idx.end(), nbr[i].begin(), nbr[i].end());
+        G.row_ptr[i + 1] = (int64_t)G.col_idx.size();
+    }
+    G.val.assign(G.col_idx.size(), 1.0);
+    return G;
+}
+
+// Keeps the entries of X for which keep(i, j, value) holds.
+template <class Keep>
+CsrMatrix csr_filter(const CsrMatrix& X, Keep keep)
+{
+    CsrMatrix Y;
+    Y.rows = X.rows;
+    Y.cols = X.cols;
+    Y.row_ptr.assign(X.rows + 1, 0);
+    for (int i = 0; i < X.rows; ++i) {
+        for (int64_t p = X.row_ptr[i]; p < X.row_ptr[i + 1]; ++p) {
+            if (!keep(i, X.col_idx[p], X.val[p])) continue;
+            Y.col_idx.push_back(X.col_idx[p]);
+            Y.val.push_back(X.val[p]);
+        }
+        Y.row_ptr[i + 1] = (int64_t)Y.col_idx.size();
+    }
+    return Y;
+}
+
+// Triangles of an undirected graph: with L the strictly lower triangle,
+// sum((L*L) .* L) counts every triangle k < j < i exactly once.
+long long count_triangles(const CsrMatrix& G, WorkerPool& pool, MaskedStats* stats = nullptr)
+{
+    CsrMatrix L = csr_filter(G, [](int i, int j, double) { return j < i; });
+    CsrMatrix C = masked_spgemm(L, L, L, pool, stats);
+    double total = 0.0;
+    for (double v : C.val) total += v;
+    return (long long)llround(total);
+}
+
+// k-truss: the largest subgraph in which every edge lies on >= k-2 triangles.
+// Edge supports are (G*G) .* G; edges below the bound are removed and supports
+// recomputed until nothing changes. Returns the symmetric truss adjacency.
+// For k <= 2 the bound is vacuous and the truss is G itself.
+CsrMatrix k_truss(const CsrMatrix& G, int k, WorkerPool& pool, int* rounds = nullptr)
+{
+    if (k <= 2) {
+        if (rounds) *rounds = 0;
+        return G;
+    }
+    CsrMatrix cur = G;
+    int r = 0;
+    while (true) {
+        ++r;
+        CsrMatrix S = masked_spgemm(cur, cur, cur, pool);
+        // Edges missing from S have zero support.
+        CsrMatrix next = csr_filter(S, [k](int, int, double v) { return v >= k - 2; });
+        if (next.col_idx.size() == cur.col_idx.size()) break;
+        next.val.assign(next.col_idx.size(), 1.0);
+        cur = move(next);
+    }
+    if (rounds) *rounds = r;
+    return cur;
+}
+
+// |N(u) ∩ N(v)| by merging sorted neighbour lists.
+int common_neighbours(const CsrMatrix& G, int u, int v)
+{
+    int64_t x = G.row_ptr[u], y = G.row_ptr[v];
+    int c = 0;
+    while (x < G.row_ptr[u + 1] && y < G.row_ptr[v + 1]) {
+        if (G.col_idx[x] < G.col_idx[y]) ++x;
+        else if (G.col_idx[x] > G.col_idx[y]) ++y;
+        else { ++c; ++x; ++y; }
+    }
+    return c;
+}
+
+// prog graph n avg_degree T [--ktruss=k]
+int run_graph(int argc, char** argv)
+{
+    if (argc < 5) {
+        cerr << "Usage: " << argv[0] << " graph n avg_degree T [--ktruss=k]\n";
+        return 1;
+    }
+    const int n = stoi(argv[2]);
+    const double deg = stod(argv[3]);
+    const int T = max(1, stoi(argv[4]));
+    int truss_k = 0;
+    for (int i = 5; i < argc; ++i) {
+        string flag = argv[i];
+        if (flag.rfind("--ktruss=", 0) == 0) truss_k = stoi(flag.substr(9));
+        else {
+            cerr << "Unknown flag: " << flag << "\n";
+            return 1;
+        }
+    }
+
+    // Random graph with a few dense communities so triangles actually occur.
+    mt19937_64 rng(42);
+    uniform_int_distribution<int> vert(0, n - 1);
+    vector<pair<int,int>> edges;
+    const long long m = (long long)(n * deg / 2);
+    const int community = 32;
+    for (long long e = 0; e < m; ++e) {
+        int u = vert(rng);
+        int v = (e % 2 == 0) ? vert(rng)
+                             : min(n - 1, (u / community) * community + (int)(rng() % community));
+        edges.push_back({u, v});
+    }
+    CsrMatrix G = adjacency_from_edges(n, edges);
+    cout << "Graph: " << n << " vertices, " << G.col_idx.size() / 2 << " edges\n";
+
+    WorkerPool pool(T);
+    MaskedStats st;
+    auto t0 = chrono::high_resolution_clock::now();
+    long long triangles = count_triangles(G, pool, &st);
+    auto t1 = chrono::high_resolution_clock::now();
+    cout << "Triangles (masked SpGEMM, T=" << T << "): " << triangles << " in "
+         << chrono::duration<double, milli>(t1 - t0).count() << " ms"
+         << " [rows: " << st.dot_rows << " masked-dot, " << st.gustavson_rows << " Gustavson]\n";
+
+    // Reference: for every edge u < v, count common neighbours w > v.
+    long long ref = 0;
+    for (int u = 0; u < n; ++u) {
+        for (int64_t p = G.row_ptr[u]; p < G.row_ptr[u + 1]; ++p) {
+            int v = G.col_idx[p];
+            if (v <= u) continue;
+            for (int64_t q = G.row_ptr[v]; q < G.row_ptr[v + 1]; ++q) {
+                int w = G.col_idx[q];
+                if (w > v && binary_search(&G.col_idx[G.row_ptr[u]], &G.col_idx[G.row_ptr[u + 1]], w)) ++ref;
+            }
+        }
+    }
+    cout << "Triangles (reference): " << ref << "\n";
+
+    if (truss_k > 2) {
+        int rounds = 0;
+        auto k0 = chrono::high_resolution_clock::now();
+        CsrMatrix K = k_truss(G, truss_k, pool, &rounds);
+        auto k1 = chrono::high_resolution_clock::now();
+        int weak = 0;
+        for (int u = 0; u < n; ++u) {
+            for (int64_t p = K.row_ptr[u]; p < K.row_ptr[u + 1]; ++p) {
+                if (common_neighbours(K, u, K.col_idx[p]) < truss_k - 2) ++weak;
+            }
+        }
+        cout << truss_k << "-truss: " << K.col_idx.size() / 2 << " edges after " << rounds
+             << " rounds, " << chrono::duration<double, milli>(k1 - k0).count() << " ms"
+             << " (edges below support: " << weak << ")\n";
+    }
+    return 0;
+}
+
+// ---------------------------------------------------------------------------
+// Sequence DP: edit distance and LCS
+// ---------------------------------------------------------------------------
+
+// Unit-cost edit distance, cell by cell with two rows (reference kernel).
+int edit_distance_dp(const string& a, const string& b)
+{
+    vector<int> prev(b.size() + 1), cur(b.size() + 1);
+    iota(prev.begin(), prev.end(), 0);
+    for (size_t i = 1; i <= a.size(); ++i) {
+        cur[0] = (int)i;
+        for (size_t j = 1; j <= b.size(); ++j) {
+            cur[j] = min({prev[j] + 1, cur[j - 1] + 1, prev[j - 1] + (a[i - 1] != b[j - 1])});
+        }
+        swap(prev, cur);
+    }
+    return prev[b.size()];
+}
+
+int lcs_dp(const string& a, const string& b)
+{
+    vector<int> prev(b.size() + 1, 0), cur(b.size() + 1, 0);
+    for (size_t i = 1; i <= a.size(); ++i) {
+        for (size_t j = 1; j <= b.size(); ++j) {
+            cur[j] = a[i - 1] == b[j - 1] ? prev[j - 1] + 1 : max(prev[j], cur[j - 1]);
+        }
+        swap(prev, cur);
+    }
+    return prev[b.size()];
+}
+
+// Match masks of a pattern for the bit-parallel kernels: bit i of word w of
+// peq[c] is set when pattern[64*w + i] == c. Patterns longer than 64 span
+// several words ("blocks"); bits past the pattern end stay zero.
+struct BitPattern {
+    int m = 0, words = 0;
+    vector<uint64_t> peq;   // 256 * words
+
+    const uint64_t* eq(unsigned char c) const { return &peq[(size_t)c * words]; }
+};
+
+BitPattern make_bit_pattern(const string& p)
+{
+    BitPattern P;
+    P.m = (int)p.size();
+    P.words = max(1, (P.m + 63) / 64);
+    P.peq.assign((size_t)256 * P.words, 0);
+    for (int i = 0; i < P.m; ++i) {
+        P.peq[(size_t)(unsigned char)p[i] * P.words + i / 64] |= uint64_t(1) << (i % 64);
+    }
+    return P;
+}
+
+// One 64-row block of Myers' algorithm in Hyyro's formulation. hin is the
+// horizontal delta (-1, 0, +1) entering the block's top row; the delta leaving
+// row `out_bit` of the block is returned.
+inline int myers_block(uint64_t& Pv, uint64_t& Mv, uint64_t Eq, int hin, int out_bit)
+{
+    const uint64_t hin_neg = hin < 0 ? 1 : 0;
+    const uint64_t hin_pos = hin > 0 ? 1 : 0;
+    const uint64_t Xv = Eq | Mv;
+    Eq |= hin_neg;
+    const uint64_t Xh = (((Eq & Pv) + Pv) ^ Pv) | Eq;
+    uint64_t Ph = Mv | ~(Xh | Pv);
+    uint64_t Mh = Pv & Xh;
+    const int hout = (int)((Ph >> out_bit) & 1) - (int)((Mh >> out_bit) & 1);
+    Ph = (Ph << 1) | hin_pos;
+    Mh = (Mh << 1) | hin_neg;
+    Pv = Mh | ~(Xv | Ph);
+    Mv = Ph & Xv;
+    return hout;
+}
+
+// Global unit-cost edit distance between the pattern and text, 64 DP cells
+// per word operation. The score is tracked along the pattern's last row;
+// padding rows above it cannot influence it (rows depend only on lower bits).
+int edit_distance_bitpar(const BitPattern& P, const string& text)
+{
+    if (P.m == 0) return (int)text.size();
+    vector<uint64_t> Pv(P.words, ~uint64_t(0)), Mv(P.words, 0);
+    const int last_bit = (P.m - 1) % 64;
+    int score = P.m;
+    for (unsigned char c : text) {
+        const uint64_t* Eq = P.eq(c);
+        int h = 1;   // top row D[0][j] = j grows by one per column
+        for (int w = 0; w < P.words; ++w) {
+            h = myers_block(Pv[w], Mv[w], Eq[w], h, w + 1 == P.words ? last_bit : 63);
+        }
+        score += h;
+    }
+    return score;
+}
+
+// LCS length, bit-parallel (Allison-Dix / Hyyro): V starts all ones and for
+// each text character V = (V + U) | (V - U) with U = V & Eq; the carry of the
+// addition ripples across words. The LCS is the number of zero bits in V.
+int lcs_bitpar(const BitPattern& P, const string& text)
+{
+    vector<uint64_t> V(P.words, ~uint64_t(0));
+    for (unsigned char c : text) {
+        const uint64_t* Eq = P.eq(c);
+        uint64_t carry = 0;
+        for (int w = 0; w < P.words; ++w) {
+            const uint64_t v = V[w];
+            const uint64_t u = v & Eq[w];
+            const uint64_t sum = v + u + carry;
+            carry = (sum < v || (carry && sum == v)) ? 1 : 0;
+            V[w] = sum | (v & ~u);   // v - u never borrows since u is a subset of v
+        }
+    }
+    int zeros = 0;
+    for (int w = 0; w < P.words; ++w) {
+        const int bits = min(64, P.m - 64 * w);
+        if (bits <= 0) break;
+        uint64_t mask = bits == 64 ? ~uint64_t(0) : (uint64_t(1) << bits) - 1;
+        zeros += bits - __builtin_popcountll(V[w] & mask);
+    }
+    return zeros;
+}
+
+// Ukkonen's band: only cells with |i - j| <= k are computed. Returns the edit
+// distance if it is <= k, otherwise k + 1 -- as soon as a whole row of the
+// band exceeds k, since the distance can then no longer come back under it.
+int edit_distance_within(const string& a, const string& b, int k)
+{
+    const int n = (int)a.size(), m = (int)b.size();
+    if (abs(n - m) > k) return k + 1;
+    const int width = 2 * k + 1;
+    const int inf = k + 1;
+    // Cell (i, j) lives at slot j - i + k of its row.
+    vector<int> prev(width, inf), cur(width, inf);
+    for (int j = 0; j <= min(m, k); ++j) prev[j + k] = j;
+    for (int i = 1; i <= n; ++i) {
+        const int j0 = max(0, i - k), j1 = min(m, i + k);
+        int row_min = inf;
+        fill(cur.begin(), cur.end(), inf);
+        for (int j = j0; j <= j1; ++j) {
+            const int s = j - i + k;
+            int v;
+            if (j == 0) {
+                v = i;
+            } else {
+                v = prev[s] + (a[i - 1] != b[j - 1]);                  // diagonal: (i-1, j-1)
+                if (s + 1 < width) v = min(v, prev[s + 1] + 1);        // up:       (i-1, j)
+                if (s > 0) v = min(v, cur[s - 1] + 1);                 // left:     (i, j-1)
+            }
+            cur[s] = min(v, inf);
+            row_min = min(row_min, cur[s]);
+        }
+        if (row_min > k) return k + 1;
+        swap(prev, cur);
+    }
+    return min(prev[m - n + k], inf);
+}
+
+// Exact edit distance with an adaptive band: start narrow and double k until
+// the banded result is <= k (then no path outside the band can beat it).
+// Near-identical sequences finish in O(k * n).
+int edit_distance_banded(const string& a, const string& b)
+{
+    int k = max(8, abs((int)a.size() - (int)b.size()));
+    while (true) {
+        int d = edit_distance_within(a, b, k);
+        if (d <= k) return d;
+        k *= 2;
+    }
+}
+
+// A query pair for the batch drivers.
+struct SeqPair {
+    string a, b;
+};
+
+// Runs fn(pair) -> int over all pairs on T threads; pairs are claimed one at
+// a time from a shared counter since their lengths can differ a lot.
+template <class Fn>
+vector<int> run_pairs(const vector<SeqPair>& pairs, WorkerPool& pool, Fn fn)
+{
+    vector<int> out(pairs.size());
+    atomic<size_t> next{0};
+    pool.run([&](int) {
+        for (size_t idx; (idx = next.fetch_add(1, memory_order_relaxed)) < pairs.size();) {
+            out[idx] = fn(pairs[idx]);
+        }
+    });
+    return out;
+}
+
+// Random sequence over the first `sigma` letters and a copy with roughly
+// rate*len substitutions / insertions / deletions.
+SeqPair make_seq_pair(int len, double rate, int sigma, mt19937_64& rng)
+{
+    uniform_int_distribution<int> letter(0, sigma - 1);
+    uniform_real_distribution<double> u(0.0, 1.0);
+    SeqPair p;
+    p.a.resize(len);
+    for (auto& ch : p.a) ch = (char)('A' + letter(rng));
+    for (char ch : p.a) {
+        double r = u(rng);
+        if (r < rate / 3) continue;                                      // deletion
+        if (r < 2 * rate / 3) p.b.push_back((char)('A' + letter(rng)));  // substitution
+        else p.b.push_back(ch);
+        if (r >= 2 * rate / 3 && r < rate) p.b.push_back((char)('A' + letter(rng)));  // insertion
+    }
+    return p;
+}
+
+// prog editdist count len T [--lcs] [--band] [--max=k] [--rate=p] [--sigma=s]
+int run_editdist(int argc, char** argv)
+{
+    if (argc < 5) {
+        cerr << "Usage: " << argv[0] << " editdist count len T [--lcs] [--band] [--max=k]"
+             << " [--rate=p] [--sigma=s]\n";
+        return 1;
+    }
+    const int count = stoi(argv[2]);
+    const int len = stoi(argv[3]);
+    const int T = max(1, stoi(argv[4]));
+    bool lcs = false, band = false;
+    int max_k = -1;
+    double rate = 0.05;
+    int sigma = 4;
+    for (int i = 5; i < argc; ++i) {
+        string flag = argv[i];
+        if (flag == "--lcs") lcs = true;
+        else if (flag == "--band") band = true;
+        else if (flag.rfind("--max=", 0) == 0) max_k = stoi(flag.substr(6));
+        else if (flag.rfind("--rate=", 0) == 0) rate = stod(flag.substr(7));
+        else if (flag.rfind("--sigma=", 0) == 0) sigma = max(1, min(26, stoi(flag.substr(8))));
+        else {
+            cerr << "Unknown flag: " << flag << "\n";
+            return 1;
+        }
+    }
+    if (lcs && (band || max_k >= 0)) {
+        cerr << "--band/--max apply to edit distance only\n";
+        return 1;
+    }
+
+    mt19937_64 rng(42);
+    vector<SeqPair> pairs;
+    pairs.reserve(count);
+    for (int p = 0; p < count; ++p) pairs.push_back(make_seq_pair(len, rate, sigma, rng));
+    const string what = lcs ? "LCS" : "Edit distance";
+    const string how = max_k >= 0 ? "threshold <= " + to_string(max_k)
+                     : band       ? "adaptive band"
+                                  : "bit-parallel";
+
+    // --max=k answers "is the distance <= k?" (reporting k+1 for "no").
+    WorkerPool pool(T);
+    auto t0 = chrono::high_resolution_clock::now();
+    vector<int> fast = run_pairs(pairs, pool, [lcs, band, max_k](const SeqPair& p) {
+        if (max_k >= 0) return edit_distance_within(p.a, p.b, max_k);
+        if (band) return edit_distance_banded(p.a, p.b);
+        BitPattern P = make_bit_pattern(p.a);
+        return lcs ? lcs_bitpar(P, p.b) : edit_distance_bitpar(P, p.b);
+    });
+    auto t1 = chrono::high_resolution_clock::now();
+    double fast_ms = chrono::duration<double, milli>(t1 - t0).count();
+
+    // Cell-by-cell reference on the same pairs and threads.
+    auto r0 = chrono::high_resolution_clock::now();
+    vector<int> ref = run_pairs(pairs, pool, [lcs](const SeqPair& p) {
+        return lcs ? lcs_dp(p.a, p.b) : edit_distance_dp(p.a, p.b);
+    });
+    auto r1 = chrono::high_resolution_clock::now();
+    double ref_ms = chrono::duration<double, milli>(r1 - r0).count();
+
+    int mismatches = 0, within = 0;
+    for (int p = 0; p < count; ++p) {
+        int expect = max_k >= 0 ? min(ref[p], max_k + 1) : ref[p];
+        mismatches += fast[p] != expect;
+        within += max_k >= 0 && fast[p] <= max_k;
+    }
+    double cells = (double)count * len * len;
+    cout << what << " " << how << " (" << count << " pairs, len " << len << ", T=" << T << "): "
+         << fast_ms << " ms, " << cells / (fast_ms * 1e6) << " Gcells/s\n";
+    cout << what << " cell DP (T=" << T << "): " << ref_ms << " ms\n";
+    if (max_k >= 0) cout << "Pairs within " << max_k << ": " << within << "\n";
+    cout << "Mismatches vs cell DP: " << mismatches << "\n";
+    return 0;
+}
+
+// ---------------------------------------------------------------------------
+// Linear-space alignment (Hirschberg)
+// ---------------------------------------------------------------------------
+
+// Alignment operations: 'M' match, 'X' substitution, 'D' delete a[i],
+// 'I' insert b[j]. Its unit cost is the number of non-'M' operations.
+
+// Last DP row of the unit-cost alignment of a[a0,a1) against every prefix of
+// b[b0,b1) -- or, with reverse, of the reversed segments (every suffix of b).
+// Two rows of memory.
+vector<int> nw_score_row(const string& a, int a0, int a1,
+                         const string& b, int b0, int b1, bool reverse)
+{
+    const int n = a1 - a0, m = b1 - b0;
+    vector<int> prev(m + 1), cur(m + 1);
+    iota(prev.begin(), prev.end(), 0);
+    for (int i = 1; i <= n; ++i) {
+        const char ca = reverse ? a[a1 - i] : a[a0 + i - 1];
+        cur[0] = i;
+        for (int j = 1; j <= m; ++j) {
+            const char cb = reverse ? b[b1 - j] : b[b0 + j - 1];
+            cur[j] = min({prev[j] + 1, cur[j - 1] + 1, prev[j - 1] + (ca != cb)});
+        }
+        swap(prev, cur);
+    }
+    return prev;
+}
+
+// Full-table alignment with traceback for small subproblems.
+string align_small(const string& a, int a0, int a1, const string& b, int b0, int b1)
+{
+    const int n = a1 - a0, m = b1 - b0;
+    vector<int> D((size_t)(n + 1) * (m + 1));
+    auto at = [&](int i, int j) -> int& { return D[(size_t)i * (m + 1) + j]; };
+    for (int i = 0; i <= n; ++i) at(i, 0) = i;
+    for (int j = 0; j <= m; ++j) at(0, j) = j;
+    for (int i = 1; i <= n; ++i) {
+        for (int j = 1; j <= m; ++j) {
+            at(i, j) = min({at(i - 1, j) + 1, at(i, j - 1) + 1,
+                            at(i - 1, j - 1) + (a[a0 + i - 1] != b[b0 + j - 1])});
+        }
+    }
+    string ops;
+    int i = n, j = m;
+    while (i > 0 || j > 0) {
+        if (i > 0 && j > 0 && at(i, j) == at(i - 1, j - 1) + (a[a0 + i - 1] != b[b0 + j - 1])) {
+            ops.push_back(a[a0 + i - 1] == b[b0 + j - 1] ? 'M' : 'X');
+            --i; --j;
+        } else if (i > 0 && at(i, j) == at(i - 1, j) + 1) {
+            ops.push_back('D');
+            --i;
+        } else {
+            ops.push_back('I');
+            --j;
+        }
+    }
+    reverse(ops.begin(), ops.end());
+    return ops;
+}
+
+// Hirschberg divide and conquer: split a in half, find where the optimal path
+// crosses the middle row from a forward and a backward score pass, recurse on
+// the two corners.
+string hirschberg(const string& a, int a0, int a1, const string& b, int b0, int b1)
+{
+    const int n = a1 - a0, m = b1 - b0;
+    if (n == 0) return string(m, 'I');
+    if (m == 0) return string(n, 'D');
+    if (n == 1 || (long long)n * m <= 4096) return align_small(a, a0, a1, b, b0, b1);
+
+    const int amid = a0 + n / 2;
+    vector<int> F = nw_score_row(a, a0, amid, b, b0, b1, false);
+    vector<int> R = nw_score_row(a, amid, a1, b, b0, b1, true);
+    int split = 0;
+    for (int j = 1; j <= m; ++j) {
+        if (F[j] + R[m - j] < F[split] + R[m - split]) split = j;
+    }
+    F = vector<int>();
+    R = vector<int>();
+    const int bmid = b0 + split;
+    return hirschberg(a, a0, amid, b, b0, bmid) + hirschberg(a, amid, a1, b, bmid, b1);
+}
+
+// Hirschberg with its top levels as tasks on the pool. A node's two score
+// passes are separate tasks; the one finishing second picks the split and
+// forks the two halves, each with half of the node's thread budget. A node
+// whose budget is down to one thread is solved serially. Its piece is keyed
+// by its first row: the halves of a split own disjoint, non-empty row ranges,
+// so sorting the pieces by row restores the path order.
+string hirschberg_parallel(const string& a, const string& b, WorkerPool& pool)
+{
+    struct Node {
+        vector<int> F, R;
+        atomic<int> passes{2};
+    };
+    mutex pieces_mtx;
+    vector<pair<int, string>> pieces;
+    TaskGroup tasks(pool);
+
+    function<void(int, int, int, int, int)> solve = [&](int a0, int a1, int b0, int b1, int budget) {
+        const int n = a1 - a0, m = b1 - b0;
+        if (budget <= 1 || n <= 1 || (long long)n * m <= 4096) {
+            string ops = hirschberg(a, a0, a1, b, b0, b1);
+            lock_guard<mutex> lk(pieces_mtx);
+            pieces.emplace_back(a0, move(ops));
+            return;
+        }
+        const int amid = a0 + n / 2;
+        auto node = make_shared<Node>();
+        auto joined = [=, &solve, &tasks] {
+            if (node->passes.fetch_sub(1, memory_order_acq_rel) != 1) return;
+            int split = 0;
+            for (int j = 1; j <= m; ++j) {
+                if (node->F[j] + node->R[m - j] < node->F[split] + node->R[m - split]) split = j;
+            }
+            node->F = vector<int>();
+            node->R = vector<int>();
+            const int bmid = b0 + split;
+            tasks.spawn([=, &solve] { solve(a0, amid, b0, bmid, budget / 2); });
+            solve(amid, a1, bmid, b1, budget - budget / 2);
+        };
+        tasks.spawn([=, &a, &b] {
+            node->R = nw_score_row(a, amid, a1, b, b0, b1, true);
+            joined();
+        });
+        node->F = nw_score_row(a, a0, amid, b, b0, b1, false);
+        joined();
+    };
+    tasks.run([&] { solve(0, (int)a.size(), 0, (int)b.size(), pool.size()); });
+
+    sort(pieces.begin(), pieces.end(),
+         [](const pair<int, string>& x, const pair<int, string>& y) { return x.first < y.first; });
+    string ops;
+    for (const auto& p : pieces) ops += p.second;
+    return ops;
+}
+
+// Replays ops over a and b; returns the alignment cost, or -1 if the ops do
+// not describe an alignment of exactly a and b.
+int check_alignment(const string& a, const string& b, const string& ops)
+{
+    size_t i = 0, j = 0;
+    int cost = 0;
+    for (char op : ops) {
+        if (op == 'M' || op == 'X') {
+            if (i >= a.size() || j >= b.size() || (a[i] == b[j]) != (op == 'M')) return -1;
+            cost += op == 'X';
+            ++i; ++j;
+        } else if (op == 'D') {
+            if (i++ >= a.size()) return -1;
+            ++cost;
+        } else {
+            if (j++ >= b.size()) return -1;
+            ++cost;
+        }
+    }
+    return i == a.size() && j == b.size() ? cost : -1;
+}
+
+// prog align len T [--rate=p] [--sigma=s] [--show]
+int run_align(int argc, char** argv)
+{
+    if (argc < 4) {
+        cerr << "Usage: " << argv[0] << " align len T [--rate=p] [--sigma=s] [--show]\n";
+        return 1;
+    }
+    const int len = stoi(argv[2]);
+    const int T = max(1, stoi(argv[3]));
+    double rate = 0.05;
+    int sigma = 4;
+    bool show = false;
+    for (int i = 4; i < argc; ++i) {
+        string flag = argv[i];
+        if (flag == "--show") show = true;
+        else if (flag.rfind("--rate=", 0) == 0) rate = stod(flag.substr(7));
+        else if (flag.rfind("--sigma=", 0) == 0) sigma = max(1, min(26, stoi(flag.substr(8))));
+        else {
+            cerr << "Unknown flag: " << flag << "\n";
+            return 1;
+        }
+    }
+
+    mt19937_64 rng(42);
+    SeqPair p = make_seq_pair(len, rate, sigma, rng);
+
+    WorkerPool pool(T);
+    auto t0 = chrono::high_resolution_clock::now();
+    string ops = hirschberg_parallel(p.a, p.b, pool);
+    auto t1 = chrono::high_resolution_clock::now();
+    double ms = chrono::duration<double, milli>(t1 - t0).count();
+
+    int cost = check_alignment(p.a, p.b, ops);
+    int ref = edit_distance_bitpar(make_bit_pattern(p.a), p.b);
+    cout << "Hirschberg alignment (" << p.a.size() << " x " << p.b.size() << ", T=" << T << "): "
+         << ms << " ms, " << ops.size() << " columns\n";
+    cout << "Alignment cost: " << cost << " (edit distance " << ref << ")\n";
+    if (show) {
+        string ra, rb;
+        size_t i = 0, j = 0;
+        for (char op : ops) {
+            ra.push_back(op == 'I' ? '-' : p.a[i++]);
+            rb.push_back(op == 'D' ? '-' : p.b[j++]);
+        }
+        cout << ra << "\n" << ops << "\n" << rb << "\n";
+    }
+    return 0;
+}
+
+// ---------------------------------------------------------------------------
+// DAG-structured DP engine
+// ---------------------------------------------------------------------------
+
+// Dependency DAG in CSR form: an edge u -> v means state v reads value[u].
+struct DagSpec {
+    int n = 0;
+    vector<int> succ_ptr;   // n + 1 entries
+    vector<int> succ;
+};
+
+// Builds the DAG from a dependency function deps(v) -> predecessors of v.
+template <class Deps>
+DagSpec dag_from_deps(int n, Deps deps)
+{
+    vector<vector<int>> out(n);
+    for (int v = 0; v < n; ++v) {
+        for (int u : deps(v)) out[u].push_back(v);
+    }
+    DagSpec g;
+    g.n = n;
+    g.succ_ptr.assign(n + 1, 0);
+    for (int u = 0; u < n; ++u) {
+        g.succ.insert(g.succ.end(), out[u].begin(), out[u].end());
+        g.succ_ptr[u + 1] = (int)g.succ.size();
+    }
+    return g;
+}
+
+vector<int> dag_in_degrees(const DagSpec& g)
+{
+    vector<int> indeg(g.n, 0);
+    for (int v : g.succ) ++indeg[v];
+    return indeg;
+}
+
+// Reusable barrier for a fixed set of threads (C++17 has no std::barrier).
+class SpinBarrier {
+public:
+    explicit SpinBarrier(int parties) : parties_(parties) {}
+    void arrive_and_wait()
+    {
+        const int gen = generation_.load(memory_order_acquire);
+        if (waiting_.fetch_add(1, memory_order_acq_rel) + 1 == parties_) {
+            waiting_.store(0, memory_order_relaxed);
+            generation_.fetch_add(1, memory_order_acq_rel);
+        } else {
+            while (generation_.load(memory_order_acquire) == gen) this_thread::yield();
+        }
+    }
+private:
+    const int parties_;
+    atomic<int> waiting_{0};
+    atomic<int> generation_{0};
+};
+
+// Wave scheduling: states are grouped by depth (longest path from a source);
+// all states of one wave are independent, so threads split each wave and meet
+// at a barrier before the next one. eval(v, value) may read value[u] for the
+// predecessors u of v only. Returns an empty vector if g has a cycle.
+template <class Value, class Eval>
+vector<Value> dag_dp_waves(const DagSpec& g, Eval eval, WorkerPool& pool)
+{
+    const int num_threads = pool.size();
+    vector<int> indeg = dag_in_degrees(g);
+    vector<vector<int>> waves;
+    vector<int> frontier;
+    for (int v = 0; v < g.n; ++v) if (indeg[v] == 0) frontier.push_back(v);
+    int seen = 0;
+    while (!frontier.empty()) {
+        seen += (int)frontier.size();
+        vector<int> next;
+        for (int u : frontier) {
+            for (int p = g.succ_ptr[u]; p < g.succ_ptr[u + 1]; ++p) {
+                if (--indeg[g.succ[p]] == 0) next.push_back(g.succ[p]);
+            }
+        }
+        waves.push_back(move(frontier));
+        frontier = move(next);
+    }
+    if (seen != g.n) return {};
+
+    vector<Value> value(g.n);
+    SpinBarrier barrier(num_threads);
+    pool.run([&](int t) {
+        for (const auto& wave : waves) {
+            for (size_t idx = t; idx < wave.size(); idx += num_threads) {
+                value[wave[idx]] = eval(wave[idx], value);
+            }
+            barrier.arrive_and_wait();
+        }
+    });
+    return value;
+}
+
+// Dependency-counting tasks on a work-stealing pool: finishing a state
+// decrements its successors' counters, and a successor that reaches zero is
+// pushed onto the finishing worker's own deque (LIFO, cache-warm). Idle
+// workers steal the oldest entry from another worker's deque. No global
+// barriers, so long chains and wide fans overlap. Empty result on a cycle.
+template <class Value, class Eval>
+vector<Value> dag_dp_tasks(const DagSpec& g, Eval eval, WorkerPool& pool)
+{
+    const int num_threads = pool.size();
+    vector<int> indeg0 = dag_in_degrees(g);
+    vector<atomic<int>> indeg(g.n);
+    for (int v = 0; v < g.n; ++v) indeg[v].store(indeg0[v], memory_order_relaxed);
+
+    struct WorkQueue {
+        mutex mtx;
+        deque<int> items;
+    };
+    vector<WorkQueue> queues(num_threads);
+    int sources = 0;
+    for (int v = 0; v < g.n; ++v) {
+        if (indeg0[v] == 0) queues[sources++ % num_threads].items.push_back(v);
+    }
+
+    // A cycle leaves states that never become ready; detect it up front.
+    {
+        vector<int> deg = indeg0;
+        vector<int> stack;
+        for (int v = 0; v < g.n; ++v) if (deg[v] == 0) stack.push_back(v);
+        int seen = 0;
+        while (!stack.empty()) {
+            int u = stack.back();
+            stack.pop_back();
+            ++seen;
+            for (int p = g.succ_ptr[u]; p < g.succ_ptr[u + 1]; ++p) {
+                if (--deg[g.succ[p]] == 0) stack.push_back(g.succ[p]);
+            }
+        }
+        if (seen != g.n) return {};
+    }
+
+    vector<Value> value(g.n);
+    atomic<int> remaining{g.n};
+    pool.run([&](int t) {
+        auto pop_own = [&](int& v) {
+            lock_guard<mutex> lk(queues[t].mtx);
+            if (queues[t].items.empty()) return false;
+            v = queues[t].items.back();
+            queues[t].items.pop_back();
+            return true;
+        };
+        auto steal = [&](int& v) {
+            for (int d = 1; d < num_threads; ++d) {
+                WorkQueue& q = queues[(t + d) % num_threads];
+                lock_guard<mutex> lk(q.mtx);
+                if (q.items.empty()) continue;
+                v = q.items.front();
+                q.items.pop_front();
+                return true;
+            }
+            return false;
+        };
+
+        while (remaining.load(memory_order_acquire) > 0) {
+            int v;
+            if (!pop_own(v) && !steal(v)) {
+                this_thread::yield();
+                continue;
+            }
+            value[v] = eval(v, value);
+            for (int p = g.succ_ptr[v]; p < g.succ_ptr[v + 1]; ++p) {
+                const int s = g.succ[p];
+                // acq_rel: the last predecessor's write to value[] is
+                // visible to whoever evaluates s.
+                if (indeg[s].fetch_sub(1, memory_order_acq_rel) == 1) {
+                    lock_guard<mutex> lk(queues[t].mtx);
+                    queues[t].items.push_back(s);
+                }
+            }
+            remaining.fetch_sub(1, memory_order_acq_rel);
+        }
+    });
+    return value;
+}
+
+// prog dag n avg_degree T [--waves]
+// Longest weighted path ending at each state of a random DAG.
+int run_dag(int argc, char** argv)
+{
+    if (argc < 5) {
+        cerr << "Usage: " << argv[0] << " dag n avg_degree T [--waves]\n";
+        return 1;
+    }
+    const int n = stoi(argv[2]);
+    const int deg = stoi(argv[3]);
+    const int T = max(1, stoi(argv[4]));
+    bool waves = false;
+    for (int i = 5; i < argc; ++i) {
+        string flag = argv[i];
+        if (flag == "--waves") waves = true;
+        else {
+            cerr << "Unknown flag: " << flag << "\n";
+            return 1;
+        }
+    }
+
+    // Random topological order (so ids are not already sorted), predecessors
+    // drawn from a window of earlier positions, random node weights.
+    mt19937_64 rng(42);
+    vector<int> order(n);
+    iota(order.begin(), order.end(), 0);
+    shuffle(order.begin(), order.end(), rng);
+    vector<int> pos(n);
+    for (int p = 0; p < n; ++p) pos[order[p]] = p;
+    vector<vector<int>> preds(n);
+    vector<double> weight(n);
+    uniform_real_distribution<double> w(0.0, 1.0);
+    for (int p = 0; p < n; ++p) {
+        weight[order[p]] = w(rng);
+        for (int e = 0; e < deg && p > 0; ++e) {
+            int back = 1 + (int)(rng() % min(p, 4 * deg + 1));
+            preds[order[p]].push_back(order[p - back]);
+        }
+    }
+    DagSpec g = dag_from_deps(n, [&](int v) { return preds[v]; });
+
+    auto longest = [&](int v, const vector<double>& value) {
+        double best = 0.0;
+        for (int u : preds[v]) best = max(best, value[u]);
+        return best + weight[v];
+    };
+
+    WorkerPool pool(T);
+    auto t0 = chrono::high_resolution_clock::now();
+    vector<double> value = waves ? dag_dp_waves<double>(g, longest, pool)
+                                 : dag_dp_tasks<double>(g, longest, pool);
+    auto t1 = chrono::high_resolution_clock::now();
+    double ms = chrono::duration<double, milli>(t1 - t0).count();
+
+    // Serial reference in topological order.
+    vector<double> ref(n);
+    for (int p = 0; p < n; ++p) ref[order[p]] = longest(order[p], ref);
+
+    cout << "DAG DP (" << (waves ? "waves" : "tasks") << ", " << n << " states, "
+         << g.succ.size() << " edges, T=" << T << "): " << ms << " ms\n";
+    cout << "Longest path: " << *max_element(value.begin(), value.end()) << "\n";
+    cout << "Max |value - ref|: " << max_abs_diff(value, ref) << "\n";
+    return 0;
+}
+
+// ---------------------------------------------------------------------------
+// Concurrent memoization table for parallel top-down DP
+// ---------------------------------------------------------------------------
+
+// Open-addressing hash table keyed by 64-bit state ids, safe for concurrent
+// use without locks. A slot is claimed by CAS on its key; the claiming thread
+// owns the state ("in progress") until it publishes the value. Threads that
+// hit an in-progress slot wait for it instead of recomputing the state --
+// on an acyclic recursion the owner never waits on them, so this cannot
+// deadlock.
+//
+// All slots come from one arena allocated up front and carved into shards
+// (the top hash bits pick the home shard), so memory is bounded. A probe that
+// finds no room within the limit in its home shard moves on to the next few
+// shards, so skewed hashing spills into neighbours that still have room
+// instead of failing early; slots are never freed, so lookups follow the
+// same path. Only when all of those are exhausted is the state reported as
+// Full, and the caller falls back to its private OverflowCache.
+template <class Value>
+class ConcurrentMemo {
+public:
+    enum class Claim { Ready, Owner, Full };
+
+    struct Slot {
+        atomic<uint64_t> key{kEmpty};
+        atomic<int> ready{0};
+        Value value{};
+    };
+
+    ConcurrentMemo(size_t capacity, int shards)
+    {
+        shard_bits_ = 0;
+        while ((1 << shard_bits_) < max(1, shards)) ++shard_bits_;
+        shard_cap_ = 1;
+        while (shard_cap_ << shard_bits_ < capacity) shard_cap_ <<= 1;
+        arena_.reset(new Slot[shard_cap_ << shard_bits_]);
+    }
+
+    size_t capacity() const { return shard_cap_ << shard_bits_; }
+
+    // Ready: out holds the value. Owner: caller must compute and publish(*slot).
+    // Full: no room; caller computes without memoizing.
+    Claim acquire(uint64_t key, Value& out, Slot** slot)
+    {
+        const uint64_t h = mix(key);
+        const size_t shards = size_t(1) << shard_bits_;
+        const size_t home = shard_bits_ ? (size_t)(h >> (64 - shard_bits_)) : 0;
+        for (size_t hop = 0; hop < min(shards, kMaxShardHops); ++hop) {
+            Slot* base = &arena_[((home + hop) & (shards - 1)) * shard_cap_];
+            for (size_t probe = 0; probe < min(shard_cap_, kMaxProbe); ++probe) {
+                Slot& s = base[(h + probe) & (shard_cap_ - 1)];
+                uint64_t k = s.key.load(memory_order_acquire);
+                if (k == kEmpty) {
+                    if (s.key.compare_exchange_strong(k, key, memory_order_acq_rel)) {
+                        *slot = &s;
+                        return Claim::Owner;
+                    }
+                    // Lost the race; k now holds the winner's key.
+                }
+                if (k == key) {
+                    while (!s.ready.load(memory_order_acquire)) this_thread::yield();
+                    out = s.value;
+                    return Claim::Ready;
+                }
+            }
+        }
+        return Claim::Full;
+    }
+
+    void publish(Slot* slot, const Value& v)
+    {
+        slot->value = v;
+        slot->ready.store(1, memory_order_release);
+    }
+
+private:
+    static constexpr uint64_t kEmpty = ~uint64_t(0);   // not usable as a key
+    static constexpr size_t kMaxProbe = 128;
+    static constexpr size_t kMaxShardHops = 4;   // home shard + 3 neighbours
+
+    static uint64_t mix(uint64_t x)   // splitmix64 finalizer
+    {
+        x += 0x9e3779b97f4a7c15ULL;
+        x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+        return x ^ (x >> 31);
+    }
+
+    int shard_bits_ = 0;
+    size_t shard_cap_ = 1;
+    unique_ptr<Slot[]> arena_;
+};
+
+// Per-thread, direct-mapped cache for states the shared table had no room
+// for. A colliding insert simply replaces the old entry, so memory stays
+// fixed; what it buys is that a recursion overflowing the table still reuses
+// its own recent subresults instead of recomputing them exponentially.
+template <class Value>
+class OverflowCache {
+public:
+    explicit OverflowCache(size_t entries)
+    {
+        size_t cap = 1;
+        while (cap < entries) cap <<= 1;
+        keys_.assign(cap, ~uint64_t(0));
+        values_.resize(cap);
+    }
+
+    bool find(uint64_t key, Value& out) const
+    {
+        const size_t i = index(key);
+        if (keys_[i] != key) return false;
+        out = values_[i];
+        return true;
+    }
+
+    void put(uint64_t key, const Value& v)
+    {
+        const size_t i = index(key);
+        keys_[i] = key;
+        values_[i] = v;
+    }
+
+private:
+    size_t index(uint64_t key) const { return (size_t)((key * 0x9e3779b97f4a7c15ULL) >> 17) & (keys_.size() - 1); }
+
+    vector<uint64_t> keys_;
+    vector<Value> values_;
+};
+
+static const size_t kOverflowEntries = 1 << 14;
+
+// Sparse DP used by the memo mode: fewest steps to reduce n to 1 with
+// n -> n-1, n/2 (n even), n/3 (n divisible by 3), written in the form that
+// only visits O(log^2 n) states: f(n) = min(n%2 + 1 + f(n/2), n%3 + 1 + f(n/3)).
+struct MemoCounters {
+    atomic<long long> computed{0}, unmemoized{0};
+};
+
+long long min_steps(uint64_t n, ConcurrentMemo<long long>& memo, OverflowCache<long long>& local,
+                    MemoCounters& cnt)
+{
+    if (n <= 1) return 0;
+    long long v;
+    // Overflowed states are checked first: on a full table that spares the
+    // walk over every shard.
+    if (local.find(n, v)) return v;
+    ConcurrentMemo<long long>::Slot* slot = nullptr;
+    auto claim = memo.acquire(n, v, &slot);
+    if (claim == ConcurrentMemo<long long>::Claim::Ready) return v;
+
+    v = min((long long)(n % 2) + 1 + min_steps(n / 2, memo, local, cnt),
+            (long long)(n % 3) + 1 + min_steps(n / 3, memo, local, cnt));
+    if (claim == ConcurrentMemo<long long>::Claim::Owner) {
+        memo.publish(slot, v);
+        cnt.computed.fetch_add(1, memory_order_relaxed);
+    } else {
+        local.put(n, v);
+        cnt.unmemoized.fetch_add(1, memory_order_relaxed);
+    }
+    return v;
+}
+
+long long min_steps_serial(uint64_t n, unordered_map<uint64_t, long long>& memo)
+{
+    if (n <= 1) return 0;
+    auto it = memo.find(n);
+    if (it != memo.end()) return it->second;
+    long long v = min((long long)(n % 2) + 1 + min_steps_serial(n / 2, memo),
+                      (long long)(n % 3) + 1 + min_steps_serial(n / 3, memo));
+    memo[n] = v;
+    return v;
+}
+
+// prog memo queries T [--capacity=c] [--shards=s]
+int run_memo(int argc, char** argv)
+{
+    if (argc < 4) {
+        cerr << "Usage: " << argv[0] << " memo queries T [--capacity=c] [--shards=s]\n";
+        return 1;
+    }
+    const int queries = stoi(argv[2]);
+    const int T = max(1, stoi(argv[3]));
+    size_t capacity = 1 << 22;
+    int shards = 64;
+    for (int i = 4; i < argc; ++i) {
+        string flag = argv[i];
+        if (flag.rfind("--capacity=", 0) == 0) capacity = stoull(flag.substr(11));
+        else if (flag.rfind("--shards=", 0) == 0) shards = stoi(flag.substr(9));
+        else {
+            cerr << "Unknown flag: " << flag << "\n";
+            return 1;
+        }
+    }
+
+    // Nearby starting points share most of their reachable states.
+    mt19937_64 rng(42);
+    vector<uint64_t> roots(queries);
+    const uint64_t centre = uint64_t(1) << 60;
+    for (auto& r : roots) r = centre + rng() % (uint64_t(1) << 24);
+
+    ConcurrentMemo<long long> memo(capacity, shards);
+    MemoCounters cnt;
+    vector<long long> answers(queries);
+    atomic<int> next{0};
+
+    WorkerPool pool(T);
+    auto t0 = chrono::high_resolution_clock::now();
+    pool.run([&](int) {
+        OverflowCache<long long> local(kOverflowEntries);
+        for (int q; (q = next.fetch_add(1, memory_order_relaxed)) < queries;) {
+            answers[q] = min_steps(roots[q], memo, local, cnt);
+        }
+    });
+    auto t1 = chrono::high_resolution_clock::now();
+    double ms = chrono::duration<double, milli>(t1 - t0).count();
+
+    auto s0 = chrono::high_resolution_clock::now();
+    unordered_map<uint64_t, long long> serial;
+    int mismatches = 0;
+    for (int q = 0; q < queries; ++q) mismatches += answers[q] != min_steps_serial(roots[q], serial);
+    auto s1 = chrono::high_resolution_clock::now();
+
+    cout << "Parallel memoized DP (" << queries << " queries, T=" << T << ", "
+         << memo.capacity() << " slots in " << shards << " shards): " << ms << " ms\n";
+    cout << "Serial memoized DP: " << chrono::duration<double, milli>(s1 - s0).count() << " ms\n";
+    cout << "States computed: " << cnt.computed.load() << " (distinct reachable: " << serial.size()
+         << ", computed outside the table: " << cnt.unmemoized.load() << ")\n";
+    cout << "Mismatches vs serial: " << mismatches << "\n";
+    return 0;
+}
+
+// ---------------------------------------------------------------------------
+// Dynamic time warping subsequence search
+// ---------------------------------------------------------------------------
+
+// Candidates evaluated together by dtw_batch; the lane index is the innermost
+// array dimension so the per-cell update vectorizes across candidates.
+static const int kDtwLanes = 4;
+
+void z_normalize(const double* x, int m, double mean, double stdev, double* out, int stride = 1)
+{
+    const double inv = stdev > 1e-12 ? 1.0 / stdev : 0.0;
+    for (int i = 0; i < m; ++i) out[(size_t)i * stride] = (x[i] - mean) * inv;
+}
+
+// Upper/lower envelope of q within a Sakoe-Chiba window r.
+void dtw_envelope(const vector<double>& q, int r, vector<double>& upper, vector<double>& lower)
+{
+    const int m = (int)q.size();
+    upper.assign(m, 0.0);
+    lower.assign(m, 0.0);
+    for (int i = 0; i < m; ++i) {
+        double u = q[i], l = q[i];
+        for (int j = max(0, i - r); j <= min(m - 1, i + r); ++j) {
+            u = max(u, q[j]);
+            l = min(l, q[j]);
+        }
+        upper[i] = u;
+        lower[i] = l;
+    }
+}
+
+// LB_Kim (first/last points only), O(1).
+inline double lb_kim(const vector<double>& q, const double* c, int m)
+{
+    const double d0 = q[0] - c[0], d1 = q[m - 1] - c[m - 1];
+    return d0 * d0 + d1 * d1;
+}
+
+// LB_Keogh of candidate c against the query envelope, abandoning past bsf.
+inline double lb_keogh(const vector<double>& upper, const vector<double>& lower,
+                       const double* c, int m, double bsf)
+{
+    double lb = 0.0;
+    for (int i = 0; i < m && lb < bsf; ++i) {
+        if (c[i] > upper[i]) lb += (c[i] - upper[i]) * (c[i] - upper[i]);
+        else if (c[i] < lower[i]) lb += (lower[i] - c[i]) * (lower[i] - c[i]);
+    }
+    return lb;
+}
+
+// Windowed DTW (squared point costs) of q against kDtwLanes candidates at
+// once. cand holds candidate j-th points interleaved: cand[j*kDtwLanes + l].
+// Stops early once every lane's row minimum exceeds bsf; abandoned lanes
+// report +inf.
+void dtw_batch(const vector<double>& q, const double* cand, int r, double bsf,
+               double* out, vector<double>& prev, vector<double>& cur)
+{
+    const int m = (int)q.size();
+    const double inf = numeric_limits<double>::infinity();
+    const int L = kDtwLanes;
+    prev.assign((size_t)(m + 1) * L, inf);
+    cur.assign((size_t)(m + 1) * L, inf);
+    for (int l = 0; l < L; ++l) prev[l] = 0.0;
+
+    for (int i = 1; i <= m; ++i) {
+        const int j0 = max(1, i - r), j1 = min(m, i + r);
+        double row_min[kDtwLanes];
+        for (int l = 0; l < L; ++l) {
+            row_min[l] = inf;
+            cur[(size_t)(j0 - 1) * L + l] = inf;
+        }
+        const double qi = q[i - 1];
+        for (int j = j0; j <= j1; ++j) {
+            const double* c = &cand[(size_t)(j - 1) * L];
+            const double* up = &prev[(size_t)j * L];
+            const double* diag = &prev[(size_t)(j - 1) * L];
+            const double* left = &cur[(size_t)(j - 1) * L];
+            double* dst = &cur[(size_t)j * L];
+            for (int l = 0; l < L; ++l) {
+                const double d = qi - c[l];
+                const double v = d * d + min(diag[l], min(up[l], left[l]));
+                dst[l] = v;
+                row_min[l] = min(row_min[l], v);
+            }
+        }
+        if (j1 < m) {
+            for (int l = 0; l < L; ++l) cur[(size_t)(j1 + 1) * L + l] = inf;
+        }
+        bool all_out = true;
+        for (int l = 0; l < L; ++l) all_out = all_out && row_min[l] >= bsf;
+        if (all_out) {
+            for (int l = 0; l < L; ++l) out[l] = inf;
+            return;
+        }
+        swap(prev, cur);
+    }
+    for (int l = 0; l < L; ++l) out[l] = prev[(size_t)m * L + l];
+}
+
+struct DtwStats {
+    atomic<long long> kim_pruned{0}, keogh_pruned{0}, dtw_computed{0};
+};
+
+struct DtwMatch {
+    double dist = numeric_limits<double>::infinity();
+    int start = -1;
+};
+
+// Best z-normalized DTW match of q in every length-m window of s. Each
+// candidate passes LB_Kim, then LB_Keogh, against the shared best-so-far;
+// survivors are queued per thread and evaluated kDtwLanes at a time with
+// early abandoning. Threads take chunks of start positions.
+DtwMatch dtw_search(const vector<double>& s, const vector<double>& query, int r,
+                    WorkerPool& pool, DtwStats& stats)
+{
+    const int num_threads = pool.size();
+    const int m = (int)query.size();
+    const int windows = (int)s.size() - m + 1;
+    if (windows <= 0 || m == 0) return {};
+
+    vector<double> q(m), upper, lower;
+    {
+        double sum = 0.0, sq = 0.0;
+        for (double v : query) { sum += v; sq += v * v; }
+        const double mean = sum / m;
+        z_normalize(query.data(), m, mean, sqrt(max(0.0, sq / m - mean * mean)), q.data());
+    }
+    dtw_envelope(q, r, upper, lower);
+
+    vector<double> pre(s.size() + 1, 0.0), pre2(s.size() + 1, 0.0);
+    for (size_t i = 0; i < s.size(); ++i) {
+        pre[i + 1] = pre[i] + s[i];
+        pre2[i + 1] = pre2[i] + s[i] * s[i];
+    }
+
+    atomic<double> bsf{numeric_limits<double>::infinity()};
+    auto offer = [&](double d) {
+        double cur = bsf.load(memory_order_relaxed);
+        while (d < cur && !bsf.compare_exchange_weak(cur, d, memory_order_relaxed)) {}
+    };
+
+    const int chunk = 1024;
+    atomic<int> next{0};
+    vector<DtwMatch> best(num_threads);
+    pool.run([&](int t) {
+        vector<double> c(m), batch((size_t)m * kDtwLanes), prev, cur;
+        int lane_start[kDtwLanes];
+        int lanes = 0;
+        long long kim = 0, keogh = 0, computed = 0;
+
+        auto flush = [&] {
+            if (lanes == 0) return;
+            for (int l = lanes; l < kDtwLanes; ++l) {
+                for (int j = 0; j < m; ++j) batch[(size_t)j * kDtwLanes + l] = 0.0;
+            }
+            double out[kDtwLanes];
+            dtw_batch(q, batch.data(), r, bsf.load(memory_order_relaxed), out, prev, cur);
+            for (int l = 0; l < lanes; ++l) {
+                if (out[l] < best[t].dist) best[t] = {out[l], lane_start[l]};
+                offer(out[l]);
+            }
+            computed += lanes;
+            lanes = 0;
+        };
+
+        for (int w0; (w0 = next.fetch_add(chunk, memory_order_relaxed)) < windows;) {
+            for (int w = w0; w < min(windows, w0 + chunk); ++w) {
+                const double mean = (pre[w + m] - pre[w]) / m;
+                const double var = (pre2[w + m] - pre2[w]) / m - mean * mean;
+                z_normalize(&s[w], m, mean, sqrt(max(0.0, var)), c.data());
+
+                const double bound = bsf.load(memory_order_relaxed);
+                if (lb_kim(q, c.data(), m) >= bound) { ++kim; continue; }
+                if (lb_keogh(upper, lower, c.data(), m, bound) >= bound) { ++keogh; continue; }
+
+                for (int j = 0; j < m; ++j) batch[(size_t)j * kDtwLanes + lanes] = c[j];
+                lane_start[lanes++] = w;
+                if (lanes == kDtwLanes) flush();
+            }
+        }
+        flush();
+        stats.kim_pruned += kim;
+        stats.keogh_pruned += keogh;
+        stats.dtw_computed += computed;
+    });
+
+    DtwMatch res;
+    for (const auto& b : best) {
+        if (b.dist < res.dist || (b.dist == res.dist && b.start < res.start)) res = b;
+    }
+    return res;
+}
+
+// Plain windowed DTW of two z-normalized sequences (reference).
+double dtw_plain(const vector<double>& a, const vector<double>& b, int r)
+{
+    const int m = (int)a.size();
+    const double inf = numeric_limits<double>::infinity();
+    vector<double> prev(m + 1, inf), cur(m + 1, inf);
+    prev[0] = 0.0;
+    for (int i = 1; i <= m; ++i) {
+        fill(cur.begin(), cur.end(), inf);
+        for (int j = max(1, i - r); j <= min(m, i + r); ++j) {
+            const double d = a[i - 1] - b[j - 1];
+            cur[j] = d * d + min({prev[j - 1], prev[j], cur[j - 1]});
+        }
+        swap(prev, cur);
+    }
+    return prev[m];
+}
+
+// prog dtw n m r T [--brute]
+int run_dtw(int argc, char** argv)
+{
+    if (argc < 6) {
+        cerr << "Usage: " << argv[0] << " dtw n m r T [--brute]\n";
+        return 1;
+    }
+    const int n = stoi(argv[2]);
+    const int m = stoi(argv[3]);
+    const int r = max(0, stoi(argv[4]));
+    const int T = max(1, stoi(argv[5]));
+    bool brute = false;
+    for (int i = 6; i < argc; ++i) {
+        string flag = argv[i];
+        if (flag == "--brute") brute = true;
+        else {
+            cerr << "Unknown flag: " << flag << "\n";
+            return 1;
+        }
+    }
+    if (m < 2 || n < m) {
+        cerr << "Need 2 <= m <= n\n";
+        return 1;
+    }
+
+    // Random walk; the query is a noisy, rescaled copy of one of its windows.
+    mt19937_64 rng(42);
+    normal_distribution<double> step(0.0, 1.0);
+    vector<double> s(n);
+    double x = 0.0;
+    for (auto& v : s) v = (x += step(rng));
+    const int planted = (int)(rng() % (n - m + 1));
+    vector<double> query(m);
+    for (int i = 0; i < m; ++i) query[i] = 2.0 * s[planted + i] + 5.0 + 0.1 * step(rng);
+
+    WorkerPool pool(T);
+    DtwStats st;
+    auto t0 = chrono::high_resolution_clock::now();
+    DtwMatch best = dtw_search(s, query, r, pool, st);
+    auto t1 = chrono::high_resolution_clock::now();
+    double ms = chrono::duration<double, milli>(t1 - t0).count();
+
+    const long long windows = n - m + 1;
+    cout << "DTW search (n=" << n << ", m=" << m << ", r=" << r << ", T=" << T << "): " << ms << " ms\n";
+    cout << "Best match at " << best.start << " (planted " << planted << "), DTW " << best.dist << "\n";
+    cout << "Pruned: " << st.kim_pruned.load() << " LB_Kim, " << st.keogh_pruned.load()
+         << " LB_Keogh; DTW run on " << st.dtw_computed.load() << " of " << windows << "\n";
+
+    if (brute) {
+        auto zn = [m](const double* p) {
+            double sum = 0.0, sq = 0.0;
+            for (int i = 0; i < m; ++i) { sum += p[i]; sq += p[i] * p[i]; }
+            double mean = sum / m;
+            vector<double> z(m);
+            z_normalize(p, m, mean, sqrt(max(0.0, sq / m - mean * mean)), z.data());
+            return z;
+        };
+        auto b0 = chrono::high_resolution_clock::now();
+        vector<double> qz = zn(query.data());
+        DtwMatch ref;
+        for (int w = 0; w + m <= n; ++w) {
+            double d = dtw_plain(qz, zn(&s[w]), r);
+            if (d < ref.dist) ref = {d, w};
+        }
+        auto b1 = chrono::high_resolution_clock::now();
+        cout << "Brute force: match at " << ref.start << ", DTW " << ref.dist << " in "
+             << chrono::duration<double, milli>(b1 - b0).count() << " ms\n";
+    }
+    return 0;
+}
+
+// ---------------------------------------------------------------------------
+// Hierarchical (per-socket / per-LLC) scheduling
+// ---------------------------------------------------------------------------
+
+// A group of CPUs sharing a last-level cache (or a socket).
+struct CpuDomain {
+    vector<int> cpus;
+};
+
+// Parses a sysfs CPU list such as "0-3,8-11".
+vector<int> parse_cpu_list(const string& s)
+{
+    vector<int> cpus;
+    size_t pos = 0;
+    while (pos < s.size()) {
+        size_t end = s.find(',', pos);
+        if (end == string::npos) end = s.size();
+        string part = s.substr(pos, end - pos);
+        size_t dash = part.find('-');
+        try {
+            if (dash == string::npos) {
+                cpus.push_back(stoi(part));
+            } else {
+                for (int c = stoi(part.substr(0, dash)); c <= stoi(part.substr(dash + 1)); ++c) cpus.push_back(c);
+            }
+        } catch (...) {
+            // Trailing newline or junk: ignore the fragment.
+        }
+        pos = end + 1;
+    }
+    return cpus;
+}
+
+string read_first_line(const string& path)
+{
+    ifstream in(path);
+    string line;
+    getline(in, line);
+    return line;
+}
+
+// LLC domains from sysfs (cache/index3 shared_cpu_list), falling back to
+// physical packages, then to a single domain of all CPUs.
+vector<CpuDomain> detect_cpu_domains()
+{
+    const int ncpu = max(1, (int)thread::hardware_concurrency());
+    map<string, CpuDomain> by_key;
+    for (int c = 0; c < ncpu; ++c) {
+        const string base = "/sys/devices/system/cpu/cpu" + to_string(c);
+        string key = read_first_line(base + "/cache/index3/shared_cpu_list");
+        if (key.empty()) key = "pkg" + read_first_line(base + "/topology/physical_package_id");
+        by_key[key].cpus.push_back(c);
+    }
+    vector<CpuDomain> domains;
+    for (auto& kv : by_key) domains.push_back(kv.second);
+    return domains;
+}
+
+// Fake topology for --domains=D: D domains without CPU ids (no pinning).
+vector<CpuDomain> simulated_domains(int d)
+{
+    return vector<CpuDomain>(max(1, d));
+}
+
+// Affinity mask of one thread, so a pinned pool thread can be put back the way
+// it was: the pool outlives the multiply and runs unrelated jobs afterwards.
+struct SavedAffinity {
+#ifdef __linux__
+    cpu_set_t set;
+#endif
+    bool valid = false;
+
+    void save()
+    {
+#ifdef __linux__
+        valid = pthread_getaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#endif
+    }
+    void restore()
+    {
+#ifdef __linux__
+        if (valid) pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#endif
+        valid = false;
+    }
+};
+
+bool pin_current_thread(int cpu)
+{
+#ifdef __linux__
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+    (void)cpu;
+    return false;
+#endif
+}
+
+// Mutex-protected deque of tiles; the owner pops the back, thieves the front.
+struct TileQueue {
+    mutex mtx;
+    deque<Tile> items;
+
+    bool pop_back(Tile& t)
+    {
+        lock_guard<mutex> lk(mtx);
+        if (items.empty()) return false;
+        t = items.back();
+        items.pop_back();
+        return true;
+    }
+    bool steal_front(Tile& t)
+    {
+        lock_guard<mutex> lk(mtx);
+        if (items.empty()) return false;
+        t = items.front();
+        items.pop_front();
+        return true;
+    }
+};
+
+struct HierStats {
+    atomic<long long> local{0}, stolen_in_domain{0}, stolen_across{0};
+};
+
+// Two-level partitioning on the context's pool. Level 1 gives each domain a
+// contiguous band of C rows (proportional to its thread count) and a private
+// copy of B, first-touched by the domain's own (already pinned) threads so it
+// lands in local memory. Level 2 deals the band's tiles round-robin to the
+// domain's threads. A thread that runs dry steals from siblings in its own
+// domain first and only crosses into other domains once its whole domain is
+// out of work. Pinned threads get their previous affinity back at the end.
+void multiply_hierarchical(EngineContext& ctx, const vector<CpuDomain>& domains,
+                           const vector<double>& A, const vector<double>& B, vector<double>& C,
+                           int M, int K, int N, HierStats& stats)
+{
+    const int T = ctx.threads();
+    const int D = max(1, min((int)domains.size(), T));
+
+    // Thread t belongs to domain dom_of[t]; domains get T/D threads (+1 for the first T%D).
+    vector<int> dom_of(T), first(D + 1, 0);
+    for (int d = 0; d < D; ++d) first[d + 1] = first[d] + T / D + (d < T % D ? 1 : 0);
+    for (int d = 0; d < D; ++d) for (int t = first[d]; t < first[d + 1]; ++t) dom_of[t] = d;
+
+    vector<int> row0(D + 1, 0);
+    for (int d = 0; d < D; ++d) row0[d + 1] = (int)((long long)M * first[d + 1] / T);
+
+    // new double[] rather than a vector: no value-initialisation, so the
+    // first write to each page is the pinned copy below.
+    vector<unique_ptr<double[]>> B_local(D);
+    vector<TileQueue> queues(T);
+    vector<atomic<int>> domain_tiles(D);
+    for (int d = 0; d < D; ++d) {
+        vector<Tile> tiles;
+        for (int i0 = row0[d]; i0 < row0[d + 1]; i0 += kTileSize) {
+            for (int j0 = 0; j0 < N; j0 += kTileSize) {
+                tiles.push_back({0, i0, min(row0[d + 1], i0 + kTileSize), j0, min(N, j0 + kTileSize)});
+            }
+        }
+        const int nt = first[d + 1] - first[d];
+        for (size_t k = 0; k < tiles.size(); ++k) queues[first[d] + (int)(k % nt)].items.push_back(tiles[k]);
+        domain_tiles[d].store((int)tiles.size(), memory_order_relaxed);
+        B_local[d].reset(new double[B.size()]);
+    }
+
+    vector<SavedAffinity> saved(T);
+    ctx.pool.run([&](int t) {
+        const int d = dom_of[t];
+        const int nt = first[d + 1] - first[d];
+        const int local_idx = t - first[d];
+        const auto& cpus = domains[d % domains.size()].cpus;
+        // t = 0 is the caller's own thread; leave its affinity alone.
+        if (!cpus.empty() && t != 0) {
+            saved[t].save();
+            pin_current_thread(cpus[local_idx % cpus.size()]);
+        }
+
+        // Each domain thread copies its slice of B into the domain's copy.
+        PhaseScope phase(kPhasePack);
+        const size_t slice = (B.size() + nt - 1) / nt;
+        const size_t c0 = min(B.size(), slice * local_idx), c1 = min(B.size(), c0 + slice);
+        copy(B.begin() + c0, B.begin() + c1, B_local[d].get() + c0);
+    });
+
+    ctx.pool.run([&](int t) {
+        const int d = dom_of[t];
+        long long local = 0, in_dom = 0, across = 0;
+        Tile tl;
+        auto run_tile = [&](const Tile& x, int owner_dom) {
+            compute_tile_ctx(ctx, t, A, B_local[d].get(), C, K, N, x);
+            domain_tiles[owner_dom].fetch_sub(1, memory_order_relaxed);
+        };
+        while (true) {
+            if (queues[t].pop_back(tl)) { run_tile(tl, d); ++local; continue; }
+            PhaseScope stealing(kPhaseSteal);
+            bool got = false;
+            for (int s = first[d]; s < first[d + 1] && !got; ++s) {
+                if (s != t && queues[s].steal_front(tl)) { run_tile(tl, d); ++in_dom; got = true; }
+            }
+            if (got) continue;
+            // Own domain drained: help other domains, most work left first.
+            // A domain's count includes tiles still being computed, so its
+            // queues may already be empty; keep going down the list.
+            vector<pair<int, int>> victims;
+            for (int o = 0; o < D; ++o) {
+                int left = domain_tiles[o].load(memory_order_relaxed);
+                if (o != d && left > 0) victims.push_back({left, o});
+            }
+            sort(victims.rbegin(), victims.rend());
+            for (size_t v = 0; v < victims.size() && !got; ++v) {
+                const int victim = victims[v].second;
+                for (int s = first[victim]; s < first[victim + 1] && !got; ++s) {
+                    if (queues[s].steal_front(tl)) { run_tile(tl, victim); ++across; got = true; }
+                }
+            }
+            if (!got) break;
+        }
+        stats.local += local;
+        stats.stolen_in_domain += in_dom;
+        stats.stolen_across += across;
+        saved[t].restore();
+    });
+}
+
+// ---------------------------------------------------------------------------
+// Tile-compressed matrix files
+// ---------------------------------------------------------------------------
+
+// Byte shuffle: n doubles -> 8 planes (all first bytes, all second bytes, ...).
+// Exponent/sign bytes of similar values line up and compress far better.
+void byte_shuffle(const double* in, size_t n, uint8_t* out)
+{
+    const uint8_t* src = reinterpret_cast<const uint8_t*>(in);
+    for (size_t i = 0; i < n; ++i) {
+        for (int b = 0; b < 8; ++b) out[b * n + i] = src[i * 8 + b];
+    }
+}
+
+void byte_unshuffle(const uint8_t* in, size_t n, double* out)
+{
+    uint8_t* dst = reinterpret_cast<uint8_t*>(out);
+    for (size_t i = 0; i < n; ++i) {
+        for (int b = 0; b < 8; ++b) dst[i * 8 + b] = in[b * n + i];
+    }
+}
+
+// Small LZ77 codec in the LZ4 block style. A sequence is
+//   token (4-bit literal count | 4-bit match length - 4), extra literal-count
+//   bytes if 15, the literals, 16-bit little-endian offset, extra match-length
+//   bytes if 15 (each extra byte adds up to 255; 255 means "more follows").
+// The last sequence has literals only. Matches are found through a 4096-entry
+// hash of the next four bytes, so compression is one greedy pass.
+static const int kLzMinMatch = 4;
+
+inline void lz_put_len(vector<uint8_t>& out, size_t len)
+{
+    while (len >= 255) { out.push_back(255); len -= 255; }
+    out.push_back((uint8_t)len);
+}
+
+vector<uint8_t> lz_compress(const uint8_t* in, size_t n)
+{
+    vector<uint8_t> out;
+    out.reserve(n / 2 + 16);
+    vector<int64_t> table(4096, -1);
+    auto read32 = [&](size_t p) {
+        uint32_t v;
+        memcpy(&v, in + p, 4);
+        return v;
+    };
+    size_t anchor = 0, p = 0;
+    while (n >= kLzMinMatch && p + kLzMinMatch <= n) {
+        const uint32_t seq = read32(p);
+        const size_t h = (seq * 2654435761u) >> 20;
+        const int64_t cand = table[h];
+        table[h] = (int64_t)p;
+        if (cand < 0 || p - cand > 65535 || read32((size_t)cand) != seq) {
+            ++p;
+            continue;
+        }
+        size_t len = kLzMinMatch;
+        while (p + len < n && in[cand + len] == in[p + len]) ++len;
+
+        const size_t lit = p - anchor;
+        const size_t ml = len - kLzMinMatch;
+        out.push_back((uint8_t)((min<size_t>(lit, 15) << 4) | min<size_t>(ml, 15)));
+        if (lit >= 15) lz_put_len(out, lit - 15);
+        out.insert(out.end(), in + anchor, in + p);
+        const size_t off = p - cand;
+        out.push_back((uint8_t)(off & 0xff));
+        out.push_back((uint8_t)(off >> 8));
+        if (ml >= 15) lz_put_len(out, ml - 15);
+        p += len;
+        anchor = p;
+    }
+    const size_t lit = n - anchor;
+    out.push_back((uint8_t)(min<size_t>(lit, 15) << 4));
+    if (lit >= 15) lz_put_len(out, lit - 15);
+    out.insert(out.end(), in + anchor, in + n);
+    return out;
+}
+
+// Decodes into exactly n bytes; false on malformed input.
+bool lz_decompress(const uint8_t* in, size_t in_n, uint8_t* out, size_t n)
+{
+    size_t ip = 0, op = 0;
+    auto get_len = [&](size_t& len) {
+        uint8_t b;
+        do {
+            if (ip >= in_n) return false;
+            b = in[ip++];
+            len += b;
+        } while (b == 255);
+        return true;
+    };
+    while (ip < in_n) {
+        const uint8_t token = in[ip++];
+        size_t lit = token >> 4;
+        if (lit == 15 && !get_len(lit)) return false;
+        if (ip + lit > in_n || op + lit > n) return false;
+        memcpy(out + op, in + ip, lit);
+        ip += lit;
+        op += lit;
+        if (ip == in_n) break;   // last sequence
+        if (ip + 2 > in_n) return false;
+        const size_t off = in[ip] | (in[ip + 1] << 8);
+        ip += 2;
+        size_t len = (token & 15);
+        if (len == 15 && !get_len(len)) return false;
+        len += kLzMinMatch;
+        if (off == 0 || off > op || op + len > n) return false;
+        for (size_t k = 0; k < len; ++k, ++op) out[op] = out[op - off];   // may overlap
+    }
+    return op == n;
+}
+
+// File layout (native endianness):
+//   "MTZ1", int32 rows, cols, tile, uint64 tile count
+//   per tile: uint64 offset, uint32 stored bytes, uint32 codec (0 raw, 1 LZ)
+//   tile payloads (byte-shuffled doubles of the tile, row-major within it)
+struct TileIndexEntry {
+    uint64_t offset;
+    uint32_t bytes;
+    uint32_t codec;
+};
+
+struct TileFileStats {
+    size_t raw_bytes = 0, stored_bytes = 0;
+};
+
+// Copies tile tl of X (row-major, cols wide) into buf, row-major within the tile.
+void gather_tile(const vector<double>& X, int cols, const Tile& tl, double* buf)
+{
+    const int w = tl.j1 - tl.j0;
+    for (int i = tl.i0; i < tl.i1; ++i) copy_n(&X[(size_t)i * cols + tl.j0], w, buf + (size_t)(i - tl.i0) * w);
+}
+
+// A stored tile is at most its raw size, which must fit the 32-bit payload
+// size of an index entry.
+bool tile_fits_index(int tile)
+{
+    return tile > 0 && (uint64_t)tile * tile * sizeof(double) <= UINT32_MAX;
+}
+
+// Compresses all tiles in parallel, then writes them in order. The tile is
+// clamped to the matrix so small inputs do not get oversized buffers.
+bool save_tiled(const string& path, const vector<double>& X, int rows, int cols, int tile,
+                WorkerPool& pool, string& err, TileFileStats* stats = nullptr)
+{
+    tile = max(1, min(tile, max(rows, cols)));
+    if (!tile_fits_index(tile)) {
+        err = "tile " + to_string(tile) + " is too large for the file format";
+        return false;
+    }
+    vector<Tile> tiles;
+    append_tiles(tiles, 0, rows, cols, tile);
+    const size_t tile_elems = (size_t)min(tile, rows) * min(tile, cols);   // largest actual tile
+    vector<vector<uint8_t>> payload(tiles.size());
+    vector<uint32_t> codec(tiles.size());
+
+    atomic<size_t> next{0};
+    pool.run([&](int) {
+        vector<double> buf(tile_elems);
+        vector<uint8_t> shuffled(tile_elems * 8);
+        for (size_t idx; (idx = next.fetch_add(1, memory_order_relaxed)) < tiles.size();) {
+            const Tile& tl = tiles[idx];
+            const size_t n = (size_t)(tl.i1 - tl.i0) * (tl.j1 - tl.j0);
+            gather_tile(X, cols, tl, buf.data());
+            byte_shuffle(buf.data(), n, shuffled.data());
+            vector<uint8_t> z = lz_compress(shuffled.data(), n * 8);
+            if (z.size() < n * 8) {
+                payload[idx] = move(z);
+                codec[idx] = 1;
+            } else {
+                payload[idx].assign(shuffled.begin(), shuffled.begin() + n * 8);
+                codec[idx] = 0;
+            }
+        }
+    });
+
+    ofstream out(path, ios::binary);
+    if (!out) {
+        err = "cannot open " + path;
+        return false;
+    }
+    const uint64_t count = tiles.size();
+    const int32_t dims[3] = {rows, cols, tile};
+    out.write("MTZ1", 4);
+    out.write(reinterpret_cast<const char*>(dims), sizeof(dims));
+    out.write(reinterpret_cast<const char*>(&count), sizeof(count));
+    uint64_t offset = 4 + sizeof(dims) + sizeof(count) + count * sizeof(TileIndexEntry);
+    size_t stored = 0;
+    for (size_t k = 0; k < tiles.size(); ++k) {
+        TileIndexEntry e{offset, (uint32_t)payload[k].size(), codec[k]};
+        out.write(reinterpret_cast<const char*>(&e), sizeof(e));
+        offset += payload[k].size();
+        stored += payload[k].size();
+    }
+    for (const auto& p : payload) out.write(reinterpret_cast<const char*>(p.data()), p.size());
+    if (stats) {
+        stats->raw_bytes = X.size() * sizeof(double);
+        stats->stored_bytes = stored;
+    }
+    if (!out) err = "cannot write " + path;
+    return (bool)out;
+}
+
+// Reads a tiled file into X (row-major). The header and index are checked
+// against each other and against the file size before anything is allocated,
+// so a truncated or corrupt file fails with a reason in `err` instead of an
+// enormous allocation. Threads then claim tiles, read their payload with
+// their own stream and decompress straight into X.
+bool load_tiled(const string& path, vector<double>& X, int& rows, int& cols, WorkerPool& pool,
+                string& err)
+{
+    ifstream in(path, ios::binary | ios::ate);
+    if (!in) {
+        err = "cannot open " + path;
+        return false;
+    }
+    const uint64_t file_size = (uint64_t)in.tellg();
+    in.seekg(0);
+    char magic[4];
+    int32_t dims[3];
+    uint64_t count = 0;
+    const uint64_t header = 4 + sizeof(dims) + sizeof(count);
+    if (!in.read(magic, 4) || memcmp(magic, "MTZ1", 4) != 0) {
+        err = path + " is not a tiled matrix file";
+        return false;
+    }
+    if (!in.read(reinterpret_cast<char*>(dims), sizeof(dims)) ||
+        !in.read(reinterpret_cast<char*>(&count), sizeof(count))) {
+        err = path + ": truncated header";
+        return false;
+    }
+    rows = dims[0];
+    cols = dims[1];
+    const int tile = dims[2];
+    if (rows < 0 || cols < 0 || !tile_fits_index(tile)) {
+        err = path + ": bad dimensions " + to_string(rows) + "x" + to_string(cols) + ", tile " + to_string(tile);
+        return false;
+    }
+    if ((uint64_t)rows * cols > numeric_limits<size_t>::max() / sizeof(double)) {
+        err = path + ": " + to_string(rows) + "x" + to_string(cols) + " does not fit in memory";
+        return false;
+    }
+    const uint64_t expected = (uint64_t)((rows + tile - 1) / tile) * ((cols + tile - 1) / tile);
+    if (count != expected) {
+        err = path + ": " + to_string(count) + " tiles in the header, " + to_string(expected) + " expected";
+        return false;
+    }
+    const uint64_t data_start = header + count * sizeof(TileIndexEntry);
+    if (data_start > file_size) {
+        err = path + ": truncated tile index";
+        return false;
+    }
+
+    vector<Tile> tiles;
+    append_tiles(tiles, 0, rows, cols, tile);
+    vector<TileIndexEntry> index(count);
+    if (!in.read(reinterpret_cast<char*>(index.data()), count * sizeof(TileIndexEntry))) {
+        err = path + ": truncated tile index";
+        return false;
+    }
+    for (size_t k = 0; k < count; ++k) {
+        const TileIndexEntry& e = index[k];
+        if (e.codec > 1 || e.offset < data_start || e.offset > file_size || e.bytes > file_size - e.offset) {
+            err = path + ": tile " + to_string(k) + " has a bad index entry";
+            return false;
+        }
+    }
+    X.assign((size_t)rows * cols, 0.0);
+    const size_t tile_elems = (size_t)min(tile, rows) * min(tile, cols);   // largest actual tile
+
+    atomic<size_t> next{0};
+    atomic<bool> ok{true};
+    pool.run([&](int) {
+        ifstream f(path, ios::binary);
+        vector<uint8_t> blob, shuffled(tile_elems * 8);
+        vector<double> buf(tile_elems);
+        for (size_t idx; ok && (idx = next.fetch_add(1, memory_order_relaxed)) < tiles.size();) {
+            const Tile& tl = tiles[idx];
+            const TileIndexEntry& e = index[idx];
+            const size_t n = (size_t)(tl.i1 - tl.i0) * (tl.j1 - tl.j0);
+            blob.resize(e.bytes);
+            f.seekg((streamoff)e.offset);
+            bool good = (bool)f.read(reinterpret_cast<char*>(blob.data()), e.bytes);
+            if (good && e.codec == 1) good = lz_decompress(blob.data(), blob.size(), shuffled.data(), n * 8);
+            else if (good) good = e.bytes == n * 8 && (copy(blob.begin(), blob.end(), shuffled.begin()), true);
+            if (!good) {
+                ok = false;
+                break;
+            }
+            byte_unshuffle(shuffled.data(), n, buf.data());
+            const int w = tl.j1 - tl.j0;
+            for (int i = tl.i0; i < tl.i1; ++i) {
+                copy_n(buf.data() + (size_t)(i - tl.i0) * w, w, &X[(size_t)i * cols + tl.j0]);
+            }
+        }
+    });
+    if (!ok) err = path + ": a tile payload failed to decode";
+    return ok;
+}
+
+// prog tilefile M N T path [--kind=random|quantized|sparse|smooth] [--tile=t]
+int run_tilefile(int argc, char** argv)
+{
+    if (argc < 6) {
+        cerr << "Usage: " << argv[0] << " tilefile M N T path [--kind=random|quantized|sparse|smooth]"
+             << " [--tile=t]\n";
+        return 1;
+    }
+    const int M = stoi(argv[2]);
+    const int N = stoi(argv[3]);
+    const int T = max(1, stoi(argv[4]));
+    const string path = argv[5];
+    string kind = "smooth";
+    int tile = 128;
+    for (int i = 6; i < argc; ++i) {
+        string flag = argv[i];
+        if (flag.rfind("--kind=", 0) == 0) kind = flag.substr(7);
+        else if (flag.rfind("--tile=", 0) == 0) tile = max(1, stoi(flag.substr(7)));
+        else {
+            cerr << "Unknown flag: " << flag << "\n";
+            return 1;
+        }
+    }
+
+    mt19937_64 rng(42);
+    uniform_real_distribution<double> dist(-1.0, 1.0);
+    vector<double> X((size_t)M * N);
+    for (int i = 0; i < M; ++i) {
+        for (int j = 0; j < N; ++j) {
+            double& v = X[(size_t)i * N + j];
+            if (kind == "random") v = dist(rng);
+            else if (kind == "quantized") v = round(dist(rng) * 16.0) / 16.0;
+            else if (kind == "sparse") v = dist(rng) > 0.9 ? dist(rng) : 0.0;
+            else if (kind == "smooth") v = sin(i * 0.01) * cos(j * 0.02);
+            else {
+                cerr << "Unknown kind: " << kind << "\n";
+                return 1;
+            }
+        }
+    }
+
+    WorkerPool pool(T);
+    TileFileStats st;
+    string err;
+    auto w0 = chrono::high_resolution_clock::now();
+    if (!save_tiled(path, X, M, N, tile, pool, err, &st)) {
+        cerr << "Cannot save: " << err << "\n";
+        return 1;
+    }
+    auto w1 = chrono::high_resolution_clock::now();
+
+    vector<double> Y;
+    int rows = 0, cols = 0;
+    auto r0 = chrono::high_resolution_clock::now();
+    if (!load_tiled(path, Y, rows, cols, pool, err)) {
+        cerr << "Cannot read " << err << "\n";
+        return 1;
+    }
+    auto r1 = chrono::high_resolution_clock::now();
+
+    const double wms = chrono::duration<double, milli>(w1 - w0).count();
+    const double rms = chrono::duration<double, milli>(r1 - r0).count();
+    cout << "Tiled file (" << kind << ", " << M << "x" << N << ", tile " << tile << ", T=" << T << "): "
+         << st.raw_bytes << " -> " << st.stored_bytes << " bytes, ratio "
+         << (double)st.raw_bytes / max<size_t>(1, st.stored_bytes) << "\n";
+    cout << "Write: " << wms << " ms, read+decompress: " << rms << " ms ("
+         << st.raw_bytes / (rms * 1e6) << " GB/s decoded)\n";
+    cout << "Round trip exact: " << (rows == M && cols == N && Y == X ? "yes" : "NO") << "\n";
+    return 0;
+}
+
+// ---------------------------------------------------------------------------
+// Tiled multiply with checkpoint / restart
+// ---------------------------------------------------------------------------
+
+// Cooperative cancellation for long multiplies: cancel() from any thread, or
+// a deadline. Workers poll stop_requested() between tiles (one relaxed load
+// and, with a deadline, one steady_clock read per tile).
+class CancelToken {
+public:
+    void cancel() { cancelled_.store(true, memory_order_relaxed); }
+
+    void set_deadline(chrono::steady_clock::time_point d)
+    {
+        deadline_ns_.store(d.time_since_epoch().count(), memory_order_relaxed);
+    }
+
+    bool stop_requested() const
+    {
+        if (cancelled_.load(memory_order_relaxed)) return true;
+        const long long d = deadline_ns_.load(memory_order_relaxed);
+        return d != kNoDeadline && chrono::steady_clock::now().time_since_epoch().count() >= d;
+    }
+
+    bool cancelled() const { return cancelled_.load(memory_order_relaxed); }
+
+private:
+    static constexpr long long kNoDeadline = numeric_limits<long long>::max();
+    atomic<bool> cancelled_{false};
+    atomic<long long> deadline_ns_{kNoDeadline};
+};
+
+// Bounded lock-free queue of tile indices (Vyukov's MPMC ring). Each slot
+// carries a sequence number, so producers only race on the tail cursor and
+// consumers on the head. close() marks the end of the stream; pop_wait()
+// returns false once the queue is closed and drained.
+class ReadyQueue {
+public:
+    explicit ReadyQueue(size_t capacity)
+    {
+        size_t cap = 2;
+        while (cap < capacity) cap <<= 1;
+        mask_ = cap - 1;
+        slots_.reset(new Slot[cap]);
+        for (size_t i = 0; i < cap; ++i) slots_[i].seq.store(i, memory_order_relaxed);
+    }
+
+    bool try_push(size_t v)
+    {
+        Slot* s;
+        size_t pos = tail_.load(memory_order_relaxed);
+        for (;;) {
+            s = &slots_[pos & mask_];
+            const long long dif = (long long)(s->seq.load(memory_order_acquire) - pos);
+            if (dif == 0) {
+                if (tail_.compare_exchange_weak(pos, pos + 1, memory_order_relaxed)) break;
+            } else if (dif < 0) {
+                return false;   // full
+            } else {
+                pos = tail_.load(memory_order_relaxed);
+            }
+        }
+        s->value = v;
+        s->seq.store(pos + 1, memory_order_release);
+        return true;
+    }
+
+    bool try_pop(size_t& v)
+    {
+        Slot* s;
+        size_t pos = head_.load(memory_order_relaxed);
+        for (;;) {
+            s = &slots_[pos & mask_];
+            const long long dif = (long long)(s->seq.load(memory_order_acquire) - (pos + 1));
+            if (dif == 0) {
+                if (head_.compare_exchange_weak(pos, pos + 1, memory_order_relaxed)) break;
+            } else if (dif < 0) {
+                return false;   // empty
+            } else {
+                pos = head_.load(memory_order_relaxed);
+            }
+        }
+        v = s->value;
+        s->seq.store(pos + mask_ + 1, memory_order_release);
+        return true;
+    }
+
+    // Producers back off while a slow consumer has the ring full.
+    void push(size_t v)
+    {
+        if (try_push(v)) return;
+        PhaseScope phase(kPhaseBarrier);
+        while (!try_push(v)) this_thread::yield();
+    }
+
+    bool pop_wait(size_t& v)
+    {
+        PhaseScope phase(kPhaseBarrier);
+        for (;;) {
+            if (try_pop(v)) return true;
+            if (closed_.load(memory_order_acquire)) return try_pop(v);
+            this_thread::yield();
+        }
+    }
+
+    void close() { closed_.store(true, memory_order_release); }
+
+private:
+    struct alignas(64) Slot {
+        atomic<size_t> seq;
+        size_t value;
+    };
+    unique_ptr<Slot[]> slots_;
+    size_t mask_ = 0;
+    alignas(64) atomic<size_t> tail_{0};
+    alignas(64) atomic<size_t> head_{0};
+    atomic<bool> closed_{false};
+};
+
+struct TiledOptions {
+    int tile = kTileSize;
+    const CancelToken* cancel = nullptr;  // stop between tiles when requested
+    // Streaming consumers, notified once per tile as soon as its part of C is
+    // final (tile indices follow append_tiles order). Callbacks run on the
+    // worker that finished the tile and must be thread-safe and short.
+    function<void(size_t, const Tile&)> on_tile;
+    function<void(int, int)> on_rows;     // rows [i0, i1) of C are complete
+    ReadyQueue* ready = nullptr;          // gets every finished index, closed on return
+    string checkpoint_path;           // empty: no checkpointing
+    int checkpoint_interval_ms = 1000;
+    bool resume = false;              // reuse tiles recorded in checkpoint_path
+};
+
+struct TiledResult {
+    size_t tiles_total = 0, tiles_resumed = 0, tiles_computed = 0;
+    size_t checkpoints_written = 0;
+    bool ok = true;
+    string error;
+    bool stopped = false;          // cancelled or past the deadline
+    vector<Tile> tiles;            // all tiles, in claim order
+    vector<uint8_t> completed;     // completed[k]: tiles[k] holds final values
+};
+
+// Checkpoint file layout (native endianness):
+//   "MTCK", int32 M, K, N, tile, uint64 tile count,
+//   progress bitmap (one bit per tile, tile order of append_tiles),
+//   C as M*N row-major doubles.
+// Tile data is always written and synced to disk before its bit, and the
+// bitmap is synced again afterwards, so every tile the bitmap marks done
+// holds its final values even after a power loss. fstream has no sync call,
+// so a second descriptor on the same file is kept for fdatasync (it flushes
+// the file, not the descriptor). Without __linux__ the flushes only reach
+// the OS, which covers a process crash but not a machine crash.
+class CheckpointFile {
+public:
+    CheckpointFile() = default;
+    CheckpointFile(const CheckpointFile&) = delete;
+    CheckpointFile& operator=(const CheckpointFile&) = delete;
+    ~CheckpointFile()
+    {
+#ifdef __linux__
+        if (sync_fd_ >= 0) ::close(sync_fd_);
+#endif
+    }
+
+    bool open(const string& path, int M, int K, int N, int tile, size_t count, bool resume)
+    {
+        M_ = M; K_ = K; N_ = N; tile_ = tile; count_ = count;
+        bitmap_.assign((count + 7) / 8, 0);
+        if (resume) {
+            f_.open(path, ios::in | ios::out | ios::binary);
+            if (f_ && read_header() && open_sync(path)) return true;
+            f_.close();
+            return false;
+        }
+        f_.open(path, ios::out | ios::trunc | ios::binary);
+        f_.close();
+        f_.open(path, ios::in | ios::out | ios::binary);
+        if (!f_ || !open_sync(path)) return false;
+        write_header();
+        write_bitmap();
+        // Extend to full size so tile writes land inside the file.
+        f_.seekp((streamoff)(data_offset() + (uint64_t)M * N * sizeof(double) - 1));
+        f_.put(0);
+        f_.flush();
+        return f_ && sync();
+    }
+
+    bool done(size_t idx) const { return bitmap_[idx / 8] >> (idx % 8) & 1; }
+
+    void load_tile(const Tile& tl, vector<double>& C)
+    {
+        for (int i = tl.i0; i < tl.i1; ++i) {
+            f_.seekg((streamoff)(data_offset() + ((uint64_t)i * N_ + tl.j0) * sizeof(double)));
+            f_.read(reinterpret_cast<char*>(&C[(size_t)i * N_ + tl.j0]), (tl.j1 - tl.j0) * sizeof(double));
+        }
+    }
+
+    void store_tile(size_t idx, const Tile& tl, const vector<double>& C)
+    {
+        for (int i = tl.i0; i < tl.i1; ++i) {
+            f_.seekp((streamoff)(data_offset() + ((uint64_t)i * N_ + tl.j0) * sizeof(double)));
+            f_.write(reinterpret_cast<const char*>(&C[(size_t)i * N_ + tl.j0]), (tl.j1 - tl.j0) * sizeof(double));
+        }
+        bitmap_[idx / 8] |= (uint8_t)(1u << (idx % 8));
+    }
+
+    // Makes the tiles stored since the last commit durable, then marks them
+    // (and makes the marks durable).
+    bool commit()
+    {
+        f_.flush();
+        if (!f_ || !sync()) return false;
+        write_bitmap();
+        f_.flush();
+        return f_ && sync();
+    }
+
+private:
+    static const uint64_t kHeaderBytes = 4 + 4 * sizeof(int32_t) + sizeof(uint64_t);
+    uint64_t data_offset() const { return kHeaderBytes + bitmap_.size(); }
+
+    void write_header()
+    {
+        const int32_t dims[4] = {M_, K_, N_, tile_};
+        const uint64_t count = count_;
+        f_.seekp(0);
+        f_.write("MTCK", 4);
+        f_.write(reinterpret_cast<const char*>(dims), sizeof(dims));
+        f_.write(reinterpret_cast<const char*>(&count), sizeof(count));
+    }
+    bool read_header()
+    {
+        char magic[4];
+        int32_t dims[4];
+        uint64_t count;
+        f_.seekg(0);
+        if (!f_.read(magic, 4) || memcmp(magic, "MTCK", 4) != 0) return false;
+        if (!f_.read(reinterpret_cast<char*>(dims), sizeof(dims))) return false;
+        if (!f_.read(reinterpret_cast<char*>(&count), sizeof(count))) return false;
+        if (dims[0] != M_ || dims[1] != K_ || dims[2] != N_ || dims[3] != tile_ || count != count_) return false;
+        return (bool)f_.read(reinterpret_cast<char*>(bitmap_.data()), bitmap_.size());
+    }
+    void write_bitmap()
+    {
+        f_.seekp((streamoff)kHeaderBytes);
+        f_.write(reinterpret_cast<const char*>(bitmap_.data()), bitmap_.size());
+    }
+
+    bool open_sync(const string& path)
+    {
+#ifdef __linux__
+        sync_fd_ = ::open(path.c_str(), O_RDWR | O_CLOEXEC);
+        return sync_fd_ >= 0;
+#else
+        (void)path;
+        return true;
+#endif
+    }
+    // Pushes everything flushed so far to the device.
+    bool sync()
+    {
+#ifdef __linux__
+        return ::fdatasync(sync_fd_) == 0;
+#else
+        return true;
+#endif
+    }
+
+    fstream f_;
+#ifdef __linux__
+    int sync_fd_ = -1;
+#endif
+    int M_ = 0, K_ = 0, N_ = 0, tile_ = 0;
+    size_t count_ = 0;
+    vector<uint8_t> bitmap_;
+};
+
+// C = A*B tile by tile on the context's pool. Threads claim tiles from a
+// shared counter and only flag a finished tile in `done`; with a checkpoint
+// path, a separate writer thread wakes every interval, writes the newly
+// finished tiles and commits the progress bitmap, so compute threads never
+// block on I/O. With resume, tiles already recorded are loaded and skipped.
+// When opt.cancel fires, workers stop claiming tiles and return to the pool
+// right away; res.completed tells which tiles of C are valid (and those are
+// still checkpointed). Tiles loaded from a checkpoint are announced to the
+// streaming consumers up front, computed ones as they finish.
+TiledResult multiply_tiled(EngineContext& ctx, const vector<double>& A, const vector<double>& B,
+                           vector<double>& C, int M, int K, int N, const TiledOptions& opt)
+{
+    TiledResult res;
+    vector<Tile> tiles;
+    append_tiles(tiles, 0, M, N, opt.tile);
+    res.tiles_total = tiles.size();
+
+    vector<atomic<uint8_t>> done(tiles.size());
+    for (auto& d : done) d.store(0, memory_order_relaxed);
+
+    CheckpointFile ckpt;
+    const bool checkpointing = !opt.checkpoint_path.empty();
+    if (checkpointing) {
+        if (!ckpt.open(opt.checkpoint_path, M, K, N, opt.tile, tiles.size(), opt.resume)) {
+            res.ok = false;
+            res.error = opt.resume ? "checkpoint missing or for a different problem: " + opt.checkpoint_path
+                                   : "cannot create checkpoint: " + opt.checkpoint_path;
+            return res;
+        }
+        for (size_t k = 0; k < tiles.size(); ++k) {
+            if (!ckpt.done(k)) continue;
+            ckpt.load_tile(tiles[k], C);
+            done[k].store(2, memory_order_relaxed);   // 2 = already on disk
+            ++res.tiles_resumed;
+        }
+    }
+
+    // Row bands complete when their last tile does.
+    const int tiles_per_band = (N + opt.tile - 1) / opt.tile;
+    vector<atomic<int>> band_left(opt.on_rows ? (M + opt.tile - 1) / opt.tile : 0);
+    for (auto& b : band_left) b.store(tiles_per_band, memory_order_relaxed);
+    auto notify = [&](size_t k) {
+        const Tile& tl = tiles[k];
+        if (opt.on_tile) opt.on_tile(k, tl);
+        if (opt.ready) opt.ready->push(k);
+        if (opt.on_rows && band_left[tl.i0 / opt.tile].fetch_sub(1, memory_order_acq_rel) == 1) {
+            opt.on_rows(tl.i0, tl.i1);
+        }
+    };
+    for (size_t k = 0; k < tiles.size(); ++k) {
+        if (done[k].load(memory_order_relaxed)) notify(k);
+    }
+
+    // Background writer: persists tiles flagged 1 and relabels them 2.
+    mutex wmtx;
+    condition_variable wcv;
+    bool finished = false;
+    auto flush_new = [&] {
+        PhaseScope phase(kPhaseIO);
+        bool any = false;
+        for (size_t k = 0; k < tiles.size(); ++k) {
+            if (done[k].load(memory_order_acquire) != 1) continue;
+            ckpt.store_tile(k, tiles[k], C);
+            done[k].store(2, memory_order_relaxed);
+            any = true;
+        }
+        if (any && ckpt.commit()) ++res.checkpoints_written;
+    };
+    thread writer;
+    if (checkpointing) {
+        writer = thread([&] {
+            unique_lock<mutex> lk(wmtx);
+            while (!finished) {
+                wcv.wait_for(lk, chrono::milliseconds(opt.checkpoint_interval_ms));
+                lk.unlock();
+                flush_new();
+                lk.lock();
+            }
+        });
+    }
+
+    atomic<size_t> next{0};
+    atomic<long long> computed{0};
+    atomic<bool> stopped{false};
+    ctx.pool.run([&](int t) {
+        for (size_t idx; (idx = next.fetch_add(1, memory_order_relaxed)) < tiles.size();) {
+            if (opt.cancel && opt.cancel->stop_requested()) {
+                stopped.store(true, memory_order_relaxed);
+                break;
+            }
+            if (done[idx].load(memory_order_relaxed)) continue;
+            compute_tile_ctx(ctx, t, A, B.data(), C, K, N, tiles[idx]);
+            done[idx].store(1, memory_order_release);
+            notify(idx);
+            computed.fetch_add(1, memory_order_relaxed);
+        }
+    });
+    res.tiles_computed = (size_t)computed.load();
+    res.stopped = stopped.load();
+    if (opt.ready) opt.ready->close();
+
+    if (checkpointing) {
+        {
+            lock_guard<mutex> lk(wmtx);
+            finished = true;
+        }
+        wcv.notify_one();
+        writer.join();
+        flush_new();
+    }
+    res.completed.resize(tiles.size());
+    for (size_t k = 0; k < tiles.size(); ++k) res.completed[k] = done[k].load(memory_order_relaxed) != 0;
+    res.tiles = move(tiles);
+    return res;
+}
+
+// ---------------------------------------------------------------------------
+// Metrics export: OpenMetrics text file and shared-memory segment
+// ---------------------------------------------------------------------------
+
+string openmetrics_text(const MetricsSnapshot& s)
+{
+    string out;
+    char line[256];
+    auto counter = [&](const char* name, const char* help, uint64_t v) {
+        snprintf(line, sizeof(line), "# TYPE %s counter\n# HELP %s %s\n%s_total %llu\n",
+                 name, name, help, name, (unsigned long long)v);
+        out += line;
+    };
+    auto histogram = [&](const char* name, const string& labels, const HistogramSnapshot& h) {
+        uint64_t cum = 0;
+        for (int b = 0; b <= kLatencyBuckets; ++b) {
+            cum += h.bucket[b];
+            char le[32];
+            if (b < kLatencyBuckets) snprintf(le, sizeof(le), "%g", 1e-6 * (double)(1ull << b));
+            else snprintf(le, sizeof(le), "+Inf");
+            snprintf(line, sizeof(line), "%s_bucket{%sle=\"%s\"} %llu\n", name, labels.c_str(), le,
+                     (unsigned long long)cum);
+            out += line;
+        }
+        const string l = labels.empty() ? "" : "{" + labels.substr(0, labels.size() - 1) + "}";
+        snprintf(line, sizeof(line), "%s_sum%s %.9f\n%s_count%s %llu\n", name, l.c_str(), h.sum_ns * 1e-9,
+                 name, l.c_str(), (unsigned long long)cum);
+        out += line;
+    };
+
+    counter("mtmul_jobs", "Multiplies (or stream batches) completed.", s.jobs);
+    counter("mtmul_flops", "Floating-point operations performed.", s.flops);
+    counter("mtmul_bytes", "Operand and result bytes moved.", s.bytes);
+    out += "# TYPE mtmul_queue_wait_seconds histogram\n"
+           "# HELP mtmul_queue_wait_seconds Time work waited before a thread picked it up.\n";
+    histogram("mtmul_queue_wait_seconds", "", s.queue_wait);
+    out += "# TYPE mtmul_kernel_latency_seconds histogram\n"
+           "# HELP mtmul_kernel_latency_seconds Time per kernel invocation (one tile or panel).\n";
+    for (int k = 0; k < kKernelCount; ++k) {
+        histogram("mtmul_kernel_latency_seconds", string("kernel=\"") + kKernelNames[k] + "\",", s.kernel[k]);
+    }
+    out += "# EOF\n";
+    return out;
+}
+
+// Shared-memory layout read by local scrapers (see the scrape mode). The
+// writer makes seq odd, copies the snapshot, then makes it even again; a
+// reader retries until it sees the same even seq before and after its copy.
+struct MetricsShm {
+    char magic[8];                          // "MTMETRIC"
+    uint32_t version;
+    uint32_t kernels;
+    atomic<uint64_t> seq;
+    uint64_t updated_unix_ms;
+    char kernel_names[kKernelCount][16];
+    MetricsSnapshot snap;
+};
+
+static const uint32_t kMetricsShmVersion = 1;
+
+// Exports a Metrics object every interval from a background thread: the text
+// file is written to path.tmp and renamed over path, so a scraper never sees
+// a half-written file; the segment is updated in place. stop() (or the
+// destructor) does a final export. The segment is left in /dev/shm for a
+// last scrape; remove it with rm /dev/shm/<name>.
+class MetricsExporter {
+public:
+    bool start(const Metrics& m, const string& path, const string& shm_name, int interval_ms, string& err)
+    {
+        metrics_ = &m;
+        path_ = path;
+        if (!shm_name.empty() && !map_shm(shm_name, err)) return false;
+        interval_ = chrono::milliseconds(max(1, interval_ms));
+        export_once();
+        worker_ = thread([this] {
+            unique_lock<mutex> lk(mtx_);
+            while (!stop_) {
+                cv_.wait_for(lk, interval_);
+                lk.unlock();
+                export_once();
+                lk.lock();
+            }
+        });
+        return true;
+    }
+
+    void stop()
+    {
+        if (!worker_.joinable()) return;
+        {
+            lock_guard<mutex> lk(mtx_);
+            stop_ = true;
+        }
+        cv_.notify_one();
+        worker_.join();
+        export_once();
+    }
+
+    ~MetricsExporter()
+    {
+        stop();
+#ifdef __linux__
+        if (shm_) munmap(shm_, sizeof(MetricsShm));
+#endif
+    }
+
+private:
+    bool map_shm(const string& name, string& err)
+    {
+#ifdef __linux__
+        const int fd = shm_open(name.c_str(), O_CREAT | O_RDWR, 0644);
+        if (fd < 0 || ftruncate(fd, sizeof(MetricsShm)) != 0) {
+            err = "cannot create shared-memory segment " + name + ": " + strerror(errno);
+            if (fd >= 0) close(fd);
+            return false;
+        }
+        void* p = mmap(nullptr, sizeof(MetricsShm), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        close(fd);
+        if (p == MAP_FAILED) {
+            err = "cannot map shared-memory segment " + name + ": " + strerror(errno);
+            return false;
+        }
+        shm_ = static_cast<MetricsShm*>(p);
+        memcpy(shm_->magic, "MTMETRIC", 8);
+        shm_->version = kMetricsShmVersion;
+        shm_->kernels = kKernelCount;
+        for (int k = 0; k < kKernelCount; ++k) {
+            snprintf(shm_->kernel_names[k], sizeof(shm_->kernel_names[k]), "%s", kKernelNames[k]);
+        }
+        return true;
+#else
+        (void)name;
+        err = "shared-memory metrics need Linux";
+        return false;
+#endif
+    }
+
+    void export_once()
+    {
+        const MetricsSnapshot s = metrics_->snapshot();
+        if (shm_) {
+            const uint64_t seq = shm_->seq.load(memory_order_relaxed);
+            shm_->seq.store(seq + 1, memory_order_relaxed);
+            atomic_thread_fence(memory_order_release);
+            shm_->updated_unix_ms = (uint64_t)chrono::duration_cast<chrono::milliseconds>(
+                chrono::system_clock::now().time_since_epoch()).count();
+            memcpy(&shm_->snap, &s, sizeof(s));
+            shm_->seq.store(seq + 2, memory_order_release);
+        }
+        if (!path_.empty()) {
+            const string tmp = path_ + ".tmp";
+            {
+                ofstream out(tmp, ios::trunc);
+                out << openmetrics_text(s);
+                if (!out) return;
+            }
+            rename(tmp.c_str(), path_.c_str());
+        }
+    }
+
+    const Metrics* metrics_ = nullptr;
+    string path_;
+    MetricsShm* shm_ = nullptr;
+    chrono::milliseconds interval_{1000};
+    thread worker_;
+    mutex mtx_;
+    condition_variable cv_;
+    bool stop_ = false;
+};
+
+// Usage: prog scrape /segment-name
+// Reads a consistent snapshot from an exporter's segment and prints it as
+// OpenMetrics text -- the same thing a local exporter would do.
+int run_scrape(int argc, char** argv)
+{
+    if (argc < 3) {
+        cerr << "Usage: " << argv[0] << " scrape /segment-name\n";
+        return 1;
+    }
+#ifdef __linux__
+    const int fd = shm_open(argv[2], O_RDONLY, 0);
+    if (fd < 0) {
+        cerr << "Cannot open segment " << argv[2] << ": " << strerror(errno) << "\n";
+        return 1;
+    }
+    void* p = mmap(nullptr, sizeof(MetricsShm), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) {
+        cerr << "Cannot map segment " << argv[2] << "\n";
+        return 1;
+    }
+    const MetricsShm* shm = static_cast<const MetricsShm*>(p);
+    if (memcmp(shm->magic, "MTMETRIC", 8) != 0 || shm->version != kMetricsShmVersion ||
+        shm->kernels != kKernelCount) {
+        cerr << "Segment " << argv[2] << " is not a metrics segment of this version\n";
+        munmap(p, sizeof(MetricsShm));
+        return 1;
+    }
+    MetricsSnapshot s;
+    uint64_t updated = 0;
+    for (;;) {
+        const uint64_t s1 = shm->seq.load(memory_order_acquire);
+        if (s1 & 1) {
+            this_thread::yield();
+            continue;
+        }
+        memcpy(&s, &shm->snap, sizeof(s));
+        updated = shm->updated_unix_ms;
+        atomic_thread_fence(memory_order_acquire);
+        if (shm->seq.load(memory_order_relaxed) == s1) break;
+    }
+    munmap(p, sizeof(MetricsShm));
+    cerr << "Segment last updated at unix ms " << updated << "\n";
+    cout << openmetrics_text(s);
+    return 0;
+#else
+    cerr << "scrape needs Linux\n";
+    return 1;
+#endif
+}
+
+// ---------------------------------------------------------------------------
+// Sampling profiler: per-thread CPU timers + phase tags
+// ---------------------------------------------------------------------------
+
+// Sample counts of one thread, indexed by phase word. The handler only does a
+// relaxed fetch_add on its own thread's slot, which is async-signal-safe.
+struct alignas(64) ProfileSlot {
+    atomic<uint64_t> counts[kPhaseWords] = {};
+    const char* role = "";
+};
+
+thread_local ProfileSlot* t_profile_slot = nullptr;
+
+// Profiles the threads that attach to it. Each attached thread gets a POSIX
+// timer on its own CPU-time clock that sends it SIGPROF every 1/hz s of CPU
+// it consumes, so blocked threads are never sampled and no perf_event access
+// is needed. Stacks are the phase tags (role;kernel;phase), not unwound
+// frames -- unwinding is not async-signal-safe -- which is what we want to
+// attribute anyway. Linux checks CPU-time timers on the scheduler tick, so
+// the effective rate tops out at CONFIG_HZ samples per CPU-second.
+class SamplingProfiler {
+public:
+    bool start(int max_threads, int hz, string& err)
+    {
+#ifdef __linux__
+        slots_.reset(new ProfileSlot[max(1, max_threads)]);
+        max_threads_ = max(1, max_threads);
+        period_ns_ = 1000000000LL / max(1, hz);
+        struct sigaction sa;
+        memset(&sa, 0, sizeof(sa));
+        sa.sa_handler = on_sigprof;
+        sa.sa_flags = SA_RESTART;
+        sigemptyset(&sa.sa_mask);
+        if (sigaction(SIGPROF, &sa, &old_action_) != 0) {
+            err = string("cannot install SIGPROF handler: ") + strerror(errno);
+            return false;
+        }
+        running_ = true;
+        return true;
+#else
+        (void)max_threads; (void)hz;
+        err = "the sampling profiler needs Linux";
+        return false;
+#endif
+    }
+
+    // Arms a CPU-time timer for the calling thread. False when all slots are
+    // taken or the timer cannot be created.
+    bool attach_current_thread(const char* role)
+    {
+#ifdef __linux__
+        const int idx = attached_.fetch_add(1);
+        if (!running_ || idx >= max_threads_) return false;
+        ProfileSlot* slot = &slots_[idx];
+        slot->role = role;
+        struct sigevent sev;
+        memset(&sev, 0, sizeof(sev));
+        sev.sigev_notify = SIGEV_THREAD_ID;
+        sev.sigev_signo = SIGPROF;
+        sev.sigev_notify_thread_id = (pid_t)syscall(SYS_gettid);
+        if (timer_create(CLOCK_THREAD_CPUTIME_ID, &sev, &t_timer) != 0) return false;
+        t_profile_slot = slot;
+        struct itimerspec its;
+        its.it_interval.tv_sec = period_ns_ / 1000000000LL;
+        its.it_interval.tv_nsec = period_ns_ % 1000000000LL;
+        its.it_value = its.it_interval;
+        timer_settime(t_timer, 0, &its, nullptr);
+        return true;
+#else
+        (void)role;
+        return false;
+#endif
+    }
+
+    void detach_current_thread()
+    {
+#ifdef __linux__
+        if (!t_profile_slot) return;
+        timer_delete(t_timer);
+        t_profile_slot = nullptr;
+#endif
+    }
+
+    // Restores the previous SIGPROF disposition, but never the default one:
+    // a signal still in flight would terminate the process.
+    void stop()
+    {
+#ifdef __linux__
+        if (!running_) return;
+        running_ = false;
+        if (old_action_.sa_handler == SIG_DFL) old_action_.sa_handler = SIG_IGN;
+        sigaction(SIGPROF, &old_action_, nullptr);
+#endif
+    }
+
+    ~SamplingProfiler() { stop(); }
+
+    // Phase breakdown over all attached threads.
+    void report(ostream& out) const
+    {
+        uint64_t by_phase[kPhaseCount] = {}, total = 0;
+        for_each_count([&](int, int w, uint64_t n) {
+            by_phase[w % kPhaseCount] += n;
+            total += n;
+        });
+        out << "Profile: " << total << " samples (" << 1e9 / period_ns_ << " Hz of thread CPU time)\n";
+        for (int p = 0; p < kPhaseCount; ++p) {
+            if (!by_phase[p]) continue;
+            out << "  " << kPhaseNames[p] << ": " << by_phase[p] << " (" << 100.0 * by_phase[p] / total << "%)\n";
+        }
+    }
+
+    // Collapsed stacks ("mtmul;role;kernel;phase count"), the input format of
+    // flamegraph.pl and speedscope.
+    bool write_collapsed(const string& path) const
+    {
+        map<string, uint64_t> stacks;
+        for_each_count([&](int t, int w, uint64_t n) {
+            const int kernel = w / kPhaseCount - 1;
+            stacks[string("mtmul;") + slots_[t].role + ";" + (kernel < 0 ? "general" : kKernelNames[kernel]) +
+                   ";" + kPhaseNames[w % kPhaseCount]] += n;
+        });
+        ofstream out(path, ios::trunc);
+        for (const auto& [stack, n] : stacks) out << stack << " " << n << "\n";
+        return (bool)out;
+    }
+
+private:
+    static void on_sigprof(int)
+    {
+        if (ProfileSlot* slot = t_profile_slot) slot->counts[t_phase_word].fetch_add(1, memory_order_relaxed);
+    }
+
+    template <class F>
+    void for_each_count(F f) const
+    {
+        const int used = min(max_threads_, attached_.load());
+        for (int t = 0; t < used; ++t) {
+            for (int w = 0; w < kPhaseWords; ++w) {
+                const uint64_t n = slots_[t].counts[w].load(memory_order_relaxed);
+                if (n) f(t, w, n);
+            }
+        }
+    }
+
+    unique_ptr<ProfileSlot[]> slots_;
+    int max_threads_ = 0;
+    atomic<int> attached_{0};
+    long long period_ns_ = 1000000;
+    bool running_ = false;
+#ifdef __linux__
+    struct sigaction old_action_;
+    static thread_local timer_t t_timer;
+#endif
+};
+
+#ifdef __linux__
+thread_local timer_t SamplingProfiler::t_timer;
+#endif
+
+// ---------------------------------------------------------------------------
+// Energy: RAPL counters via Linux powercap
+// ---------------------------------------------------------------------------
+
+// One powercap zone. energy_uj is a free-running microjoule counter that
+// wraps at max_energy_range_uj.
+struct RaplZone {
+    string name;        // package-0, dram, psys, ...
+    string path;        // .../intel-rapl:0
+    uint64_t range_uj = 0;
+    // Part of the total: package-* and dram only. core/uncore are inside the
+    // package, and psys (platform) already contains package and DRAM.
+    bool counted = false;
+};
+
+bool read_u64(const string& path, uint64_t& v)
+{
+    const string s = read_first_line(path);
+    if (s.empty() || !isdigit((unsigned char)s[0])) return false;
+    v = stoull(s);
+    return true;
+}
+
+// Top-level zones intel-rapl:P (packages, and psys on some client parts) and
+// their subzones intel-rapl:P:S (AMD exposes the same tree). On failure, or
+// when no package zone is readable, `why` says what is missing.
+vector<RaplZone> detect_rapl(string& why, const string& root = "/sys/class/powercap")
+{
+    vector<RaplZone> zones;
+    bool unreadable = false;
+    auto add = [&](const string& path) {
+        RaplZone z;
+        z.path = path;
+        z.name = read_first_line(path + "/name");
+        if (z.name.empty()) return false;
+        uint64_t e;
+        if (!read_u64(path + "/max_energy_range_uj", z.range_uj) || !read_u64(path + "/energy_uj", e)) {
+            unreadable = true;
+            return true;
+        }
+        z.counted = z.name.rfind("package-", 0) == 0 || z.name == "dram";
+        zones.push_back(z);
+        return true;
+    };
+    for (int p = 0; p < 16; ++p) {
+        const string pkg = root + "/intel-rapl:" + to_string(p);
+        if (!add(pkg)) break;
+        for (int sub = 0; sub < 8; ++sub) {
+            if (!add(pkg + ":" + to_string(sub))) break;
+        }
+    }
+    const bool any_counted = any_of(zones.begin(), zones.end(), [](const RaplZone& z) { return z.counted; });
+    if (!any_counted) {
+        why = unreadable ? "RAPL counters under " + root + " are not readable (root-only since Linux 5.10)"
+                         : "no RAPL package zones under " + root;
+        zones.clear();
+    }
+    return zones;
+}
+
+struct EnergyReading {
+    vector<double> joules;   // per zone
+    double total_j = 0.0;
+    double seconds = 0.0;
+};
+
+// Reads every zone before and after a region; a counter that went backwards
+// wrapped once (regions here are far shorter than a wrap period).
+class EnergyMeter {
+public:
+    bool init(string& why)
+    {
+        zones_ = detect_rapl(why);
+        return !zones_.empty();
+    }
+
+    const vector<RaplZone>& zones() const { return zones_; }
+
+    void start()
+    {
+        start_uj_ = sample();
+        t0_ = chrono::steady_clock::now();
+    }
+
+    EnergyReading stop() const
+    {
+        const vector<uint64_t> end = sample();
+        EnergyReading r;
+        r.seconds = chrono::duration<double>(chrono::steady_clock::now() - t0_).count();
+        for (size_t z = 0; z < zones_.size(); ++z) {
+            const uint64_t d = end[z] >= start_uj_[z] ? end[z] - start_uj_[z]
+                                                      : end[z] + zones_[z].range_uj - start_uj_[z];
+            r.joules.push_back(d * 1e-6);
+            if (zones_[z].counted) r.total_j += d * 1e-6;
+        }
+        return r;
+    }
+
+private:
+    vector<uint64_t> sample() const
+    {
+        vector<uint64_t> v(zones_.size(), 0);
+        for (size_t z = 0; z < zones_.size(); ++z) read_u64(zones_[z].path + "/energy_uj", v[z]);
+        return v;
+    }
+
+    vector<RaplZone> zones_;
+    vector<uint64_t> start_uj_;
+    chrono::steady_clock::time_point t0_;
+};
+
+// "Energy (label): 12.3 J, 45.6 W avg, 7.8 GFLOP/s per W [package-0 10.1 J,
+// dram 2.2 J; not in total: core 8.0 J, psys 15.0 J]"
+void print_energy(const string& label, const EnergyMeter& meter, const EnergyReading& r, double flops)
+{
+    const double watts = r.total_j / max(r.seconds, 1e-9);
+    cout << "Energy (" << label << "): " << r.total_j << " J, " << watts << " W avg, "
+         << (r.total_j > 0 ? flops / 1e9 / r.total_j : 0.0) << " GFLOP/s per W [";
+    for (int pass = 0; pass < 2; ++pass) {
+        bool first = true;
+        for (size_t z = 0; z < r.joules.size(); ++z) {
+            if (meter.zones()[z].counted != (pass == 0)) continue;
+            if (first && pass == 1) cout << "; not in total: ";
+            cout << (first ? "" : ", ") << meter.zones()[z].name << " " << r.joules[z] << " J";
+            first = false;
+        }
+    }
+    cout << "]\n";
+}
+
+// ---------------------------------------------------------------------------
+// Latency histogram (stream and load modes)
+// ---------------------------------------------------------------------------
+
+// Log-linear latency histogram in the HdrHistogram layout: values below 64 ns
+// are exact, above that each power of two is split into 32 sub-buckets, so
+// any recorded value is off by at most 1/32 (~3%). Mergeable, fixed size.
+class HdrHistogram {
+public:
+    static const int kSubBits = 5;
+    static const int kSub = 1 << kSubBits;
+    // Rows of kSub: two exact ones (values below 2 * kSub), then one per top
+    // bit position kSubBits + 1 .. 63.
+    static const int kBuckets = (64 - kSubBits + 1) * kSub;
+
+    void record(uint64_t v)
+    {
+        ++counts_[index(v)];
+        ++total_;
+        max_ = max(max_, v);
+        sum_ += (double)v;
+    }
+
+    void merge(const HdrHistogram& o)
+    {
+        for (int i = 0; i < kBuckets; ++i) counts_[i] += o.counts_[i];
+        total_ += o.total_;
+        max_ = max(max_, o.max_);
+        sum_ += o.sum_;
+    }
+
+    uint64_t count() const { return total_; }
+    uint64_t max_value() const { return max_; }
+    double mean() const { return total_ ? sum_ / total_ : 0.0; }
+
+    // Highest value equivalent to the q-quantile's bucket (never understates).
+    uint64_t percentile(double q) const
+    {
+        if (!total_) return 0;
+        const uint64_t target = max<uint64_t>(1, (uint64_t)ceil(q * total_));
+        uint64_t seen = 0;
+        for (int i = 0; i < kBuckets; ++i) {
+            seen += counts_[i];
+            if (seen >= target) return min(max_, highest_equivalent(i));
+        }
+        return max_;
+    }
+
+private:
+    static int index(uint64_t v)
+    {
+        if (v < 2 * kSub) return (int)v;
+        int msb = 63;
+        while (!(v >> msb)) --msb;
+        const int shift = msb - kSubBits;
+        return (shift + 1) * kSub + (int)((v >> shift) - kSub);
+    }
+
+    static uint64_t highest_equivalent(int idx)
+    {
+        if (idx < 2 * kSub) return (uint64_t)idx;
+        const int shift = idx / kSub - 1;
+        const uint64_t m = (uint64_t)(idx % kSub + kSub);
+        return ((m + 1) << shift) - 1;
+    }
+
+    vector<uint64_t> counts_ = vector<uint64_t>(kBuckets, 0);
+    uint64_t total_ = 0, max_ = 0;
+    double sum_ = 0.0;
+};
+
+// ---------------------------------------------------------------------------
+// Online row streaming: C rows for an unbounded stream of A rows
+// ---------------------------------------------------------------------------
+
+// B packed once into column panels of width w: panel p holds columns
+// [p*w, p*w + w) as a K x w row-major block (the last one zero-padded), so the
+// inner loop walks one contiguous strip of B per element of A.
+struct PackedB {
+    int K = 0, N = 0, w = kTileSize;
+    vector<double> data;
+
+    int panels() const { return (N + w - 1) / w; }
+    int width(int p) const { return min(w, N - p * w); }
+    const double* panel(int p) const { return data.data() + (size_t)p * K * w; }
+};
+
+PackedB pack_b(const vector<double>& B, int K, int N, int w = kTileSize)
+{
+    PackedB pb;
+    pb.K = K; pb.N = N; pb.w = w;
+    pb.data.assign((size_t)pb.panels() * K * w, 0.0);
+    for (int p = 0; p < pb.panels(); ++p) {
+        double* dst = pb.data.data() + (size_t)p * K * w;
+        for (int k = 0; k < K; ++k) {
+            for (int jj = 0; jj < pb.width(p); ++jj) dst[(size_t)k * w + jj] = getB(B, k, p * w + jj, N);
+        }
+    }
+    return pb;
+}
+
+// A micro-panel of incoming A rows and when its first row arrived.
+struct RowBatch {
+    int rows = 0;
+    vector<double> a;   // rows x K
+    chrono::steady_clock::time_point first_arrival;
+    chrono::steady_clock::time_point queued_at;
+};
+
+// Bounded hand-off from the reader to the compute loop. At most `capacity`
+// batches are queued, so memory stays at about capacity * batch * K doubles
+// however long the stream runs; a reader that gets ahead simply blocks.
+class BatchChannel {
+public:
+    explicit BatchChannel(size_t capacity) : cap_(max<size_t>(1, capacity)) {}
+
+    void put(RowBatch&& b)
+    {
+        unique_lock<mutex> lk(mtx_);
+        not_full_.wait(lk, [&] { return q_.size() < cap_; });
+        q_.push_back(move(b));
+        peak_ = max(peak_, q_.size());
+        not_empty_.notify_one();
+    }
+
+    bool take(RowBatch& b)
+    {
+        unique_lock<mutex> lk(mtx_);
+        not_empty_.wait(lk, [&] { return !q_.empty() || closed_; });
+        if (q_.empty()) return false;
+        b = move(q_.front());
+        q_.pop_front();
+        not_full_.notify_one();
+        return true;
+    }
+
+    void close()
+    {
+        lock_guard<mutex> lk(mtx_);
+        closed_ = true;
+        not_empty_.notify_all();
+    }
+
+    size_t peak() const { return peak_; }
+
+private:
+    mutex mtx_;
+    condition_variable not_empty_, not_full_;
+    deque<RowBatch> q_;
+    size_t cap_, peak_ = 0;
+    bool closed_ = false;
+};
+
+// C rows of one batch (rows x N). Work units are (panel, row slice) pairs,
+// with rows sliced only as far as needed to give every thread a unit.
+void stream_batch(WorkerPool& pool, const PackedB& pb, const RowBatch& b, vector<double>& c,
+                  Metrics* metrics = nullptr)
+{
+    const int K = pb.K, N = pb.N, w = pb.w;
+    const int panels = pb.panels();
+    const int T = pool.size();
+    const int parts = max(1, min(b.rows, (T + panels - 1) / panels));
+    c.assign((size_t)b.rows * N, 0.0);
+    pool.run([&](int t) {
+        for (int u = t; u < panels * parts; u += T) {
+            const int p = u % panels, part = u / panels;
+            const int r0 = (int)((long long)b.rows * part / parts);
+            const int r1 = (int)((long long)b.rows * (part + 1) / parts);
+            PhaseScope phase(kPhaseKernel, kKernelStreamPanel);
+            const auto k0 = metrics ? chrono::steady_clock::now() : chrono::steady_clock::time_point();
+            const double* bp = pb.panel(p);
+            const int width = pb.width(p);
+            for (int r = r0; r < r1; ++r) {
+                double* crow = &c[(size_t)r * N + (size_t)p * w];
+                const double* arow = &b.a[(size_t)r * K];
+                for (int k = 0; k < K; ++k) {
+                    const double a = arow[k];
+                    const double* brow = bp + (size_t)k * w;
+                    for (int jj = 0; jj < width; ++jj) crow[jj] += a * brow[jj];
+                }
+            }
+            if (metrics) metrics->observe_kernel(t, kKernelStreamPanel, ns_since(k0));
+        }
+    });
+}
+
+// Whitespace-separated numbers from stdin with a deadline, so the stream
+// reader can ship a partial batch while the producer is quiet. istream has no
+// timed read, and whatever cin had buffered would be invisible to poll(), so
+// on Linux fd 0 is read directly; elsewhere this falls back to cin and the
+// deadline is ignored.
+class StdinNumbers {
+public:
+    enum Status { kValue, kTimeout, kEof, kBad };
+
+    Status next(double& v, chrono::steady_clock::time_point deadline)
+    {
+#ifdef __linux__
+        while (true) {
+            while (pos_ < buf_.size() && isspace((unsigned char)buf_[pos_])) ++pos_;
+            size_t end = pos_;
+            while (end < buf_.size() && !isspace((unsigned char)buf_[end])) ++end;
+            if (pos_ < buf_.size() && (end < buf_.size() || eof_)) {
+                char* stop = nullptr;
+                v = strtod(buf_.c_str() + pos_, &stop);
+                const bool whole = stop == buf_.c_str() + end;
+                pos_ = end;
+                return whole ? kValue : kBad;
+            }
+            if (eof_) return kEof;
+            // Need more bytes: keep the partial token, wait for input.
+            buf_.erase(0, pos_);
+            pos_ = 0;
+            int timeout = -1;
+            if (deadline != chrono::steady_clock::time_point::max()) {
+                const auto left = chrono::duration_cast<chrono::milliseconds>(
+                    deadline - chrono::steady_clock::now() + chrono::microseconds(999));
+                timeout = (int)max<long long>(0, left.count());
+            }
+            pollfd pfd{0, POLLIN, 0};
+            const int ready = poll(&pfd, 1, timeout);
+            if (ready < 0 && errno == EINTR) continue;
+            if (ready == 0) return kTimeout;
+            char chunk[1 << 16];
+            const ssize_t got = ready < 0 ? -1 : read(0, chunk, sizeof(chunk));
+            if (got < 0 && errno == EINTR) continue;
+            if (got <= 0) eof_ = true;
+            else buf_.append(chunk, (size_t)got);
+        }
+#else
+        (void)deadline;
+        if (cin >> v) return kValue;
+        return cin.eof() ? kEof : kBad;
+#endif
+    }
+
+private:
+    string buf_;
+    size_t pos_ = 0;
+    bool eof_ = false;
+};
+
+// Usage: prog stream K N T [--batch=R] [--depth=D] [--gen=rows] [--rate=rows_per_s]
+//             [--max-wait-ms=ms] [--load-b=path] [--quiet] [--check]
+//             [--metrics=path] [--metrics-shm=/name] [--metrics-ms=ms]
+//             [--profile=path] [--profile-hz=hz]
+// Without --gen, A rows (K numbers each) are read from stdin until EOF and C
+// rows are written to stdout as soon as their batch is done. Only the main
+// thread writes to cout; statistics go to stderr so stdout stays a clean pipe.
+int run_stream(int argc, char** argv)
+{
+    if (argc < 5) {
+        cerr << "Usage: " << argv[0] << " stream K N T [--batch=R] [--depth=D] [--gen=rows]"
+             << " [--rate=rows_per_s] [--max-wait-ms=ms] [--load-b=path] [--quiet] [--check]"
+             << " [--metrics=path] [--metrics-shm=/name] [--metrics-ms=ms]"
+             << " [--profile=path] [--profile-hz=hz]\n";
+        return 1;
+    }
+    int K = stoi(argv[2]);
+    int N = stoi(argv[3]);
+    const int T = max(1, stoi(argv[4]));
+    int batch = 16, depth = 4;
+    long long gen = -1;
+    double rate = 0.0, max_wait_ms = 5.0;
+    string load_b;
+    bool quiet = false, check = false;
+    string metrics_path, metrics_shm;
+    int metrics_ms = 1000;
+    string profile_path;
+    int profile_hz = 997;
+    for (int i = 5; i < argc; ++i) {
+        string flag = argv[i];
+        if (flag.rfind("--batch=", 0) == 0) batch = max(1, stoi(flag.substr(8)));
+        else if (flag.rfind("--depth=", 0) == 0) depth = max(1, stoi(flag.substr(8)));
+        else if (flag.rfind("--gen=", 0) == 0) gen = stoll(flag.substr(6));
+        else if (flag.rfind("--rate=", 0) == 0) rate = stod(flag.substr(7));
+        else if (flag.rfind("--max-wait-ms=", 0) == 0) max_wait_ms = stod(flag.substr(14));
+        else if (flag.rfind("--load-b=", 0) == 0) load_b = flag.substr(9);
+        else if (flag == "--quiet") quiet = true;
+        else if (flag == "--check") check = true;
+        else if (flag.rfind("--metrics=", 0) == 0) metrics_path = flag.substr(10);
+        else if (flag.rfind("--metrics-shm=", 0) == 0) metrics_shm = flag.substr(14);
+        else if (flag.rfind("--metrics-ms=", 0) == 0) metrics_ms = stoi(flag.substr(13));
+        else if (flag.rfind("--profile=", 0) == 0) profile_path = flag.substr(10);
+        else if (flag.rfind("--profile-hz=", 0) == 0) profile_hz = stoi(flag.substr(13));
+        else {
+            cerr << "Unknown flag: " << flag << "\n";
+            return 1;
+        }
+    }
+
+    WorkerPool pool(T);
+    vector<double> B;
+    if (!load_b.empty()) {
+        int rows = 0, cols = 0;
+        string err;
+        if (!load_tiled(load_b, B, rows, cols, pool, err)) {
+            cerr << "Cannot load B: " << err << "\n";
+            return 1;
+        }
+        if (rows != K || cols != N) {
+            cerr << "Cannot load B (" << K << "x" << N << ") from " << load_b << ": file holds "
+                 << rows << "x" << cols << "\n";
+            return 1;
+        }
+    } else {
+        mt19937_64 rng(7);
+        uniform_real_distribution<double> dist(-1.0, 1.0);
+        B.resize((size_t)K * N);
+        for (auto& v : B) v = dist(rng);
+    }
+    // Pool threads and the reader are profiled (packing B happens before).
+    SamplingProfiler profiler;
+    const bool profiling = !profile_path.empty();
+    if (profiling) {
+        string err;
+        if (!profiler.start(T + 1, profile_hz, err)) {
+            cerr << err << "\n";
+            return 1;
+        }
+    }
+
+    PackedB pb;
+    {
+        PhaseScope phase(kPhasePack);
+        pb = pack_b(B, K, N);
+    }
+    if (!check) vector<double>().swap(B);
+
+    // Batches are jobs; queue wait is the time a batch sat in the channel.
+    Metrics metrics(T);
+    MetricsExporter exporter;
+    const bool metered = !metrics_path.empty() || !metrics_shm.empty();
+    string err;
+    if (metered && !exporter.start(metrics, metrics_path, metrics_shm, metrics_ms, err)) {
+        cerr << err << "\n";
+        return 1;
+    }
+
+    // Reader: cuts the stream into batches of up to `batch` rows (synthesized
+    // at --rate with --gen, else read from stdin). A partial batch is also
+    // flushed once its first row has waited --max-wait-ms, which bounds
+    // latency when the stream is slow; a row still being read from stdin at
+    // that point moves to the next batch.
+    BatchChannel channel(depth);
+    atomic<long long> rows_in{0};
+    bool bad_input = false;
+    ios::sync_with_stdio(false);
+    cin.tie(nullptr);   // reading must never flush cout from the reader thread
+    cout.precision(numeric_limits<double>::max_digits10);   // rows round-trip exactly
+    thread reader([&] {
+        if (profiling) profiler.attach_current_thread("reader");
+        PhaseScope phase(kPhaseIO);
+        mt19937_64 rng(42);
+        uniform_real_distribution<double> dist(-1.0, 1.0);
+        const auto start = chrono::steady_clock::now();
+        const auto wait = chrono::microseconds((long long)(max_wait_ms * 1000));
+        StdinNumbers in;
+        RowBatch cur;
+        auto flush = [&] {
+            if (cur.rows == 0) return;
+            cur.a.resize((size_t)cur.rows * K);
+            cur.queued_at = chrono::steady_clock::now();
+            channel.put(move(cur));
+            cur = RowBatch();
+        };
+        for (long long n = 0; gen < 0 || n < gen; ++n) {
+            if (gen >= 0 && rate > 0) {
+                const auto due = start + chrono::microseconds((long long)(n * 1e6 / rate));
+                if (cur.rows > 0 && due > cur.first_arrival + wait) {
+                    this_thread::sleep_until(cur.first_arrival + wait);
+                    flush();
+                }
+                this_thread::sleep_until(due);
+            }
+            if (cur.rows == 0) {
+                cur.a.resize((size_t)batch * K);
+                cur.first_arrival = chrono::steady_clock::now();
+            }
+            double* row = &cur.a[(size_t)cur.rows * K];
+            if (gen >= 0) {
+                for (int k = 0; k < K; ++k) row[k] = dist(rng);
+            } else {
+                int k = 0;
+                StdinNumbers::Status st = StdinNumbers::kValue;
+                while (k < K) {
+                    const auto deadline = cur.rows > 0 ? cur.first_arrival + wait
+                                                       : chrono::steady_clock::time_point::max();
+                    st = in.next(row[k], deadline);
+                    if (st == StdinNumbers::kValue) {
+                        // Latency counts from the first number of the batch.
+                        if (k++ == 0 && cur.rows == 0) cur.first_arrival = chrono::steady_clock::now();
+                        continue;
+                    }
+                    if (st != StdinNumbers::kTimeout) break;
+                    // Quiet producer: ship the complete rows, carry this one over.
+                    const vector<double> part(row, row + k);
+                    flush();
+                    cur.a.resize((size_t)batch * K);
+                    cur.first_arrival = chrono::steady_clock::now();
+                    row = cur.a.data();
+                    copy(part.begin(), part.end(), row);
+                }
+                if (k < K) {
+                    bad_input = k > 0 || st == StdinNumbers::kBad;
+                    break;
+                }
+            }
+            ++rows_in;
+            if (++cur.rows == batch) flush();
+        }
+        flush();
+        channel.close();
+        profiler.detach_current_thread();
+    });
+
+    if (profiling) pool.run([&](int) { profiler.attach_current_thread("worker"); });
+    vector<double> c;
+    HdrHistogram latency_ns;   // fixed size however long the stream runs
+    long long rows_out = 0, batches = 0;
+    double max_err = 0.0;
+    const auto t0 = chrono::steady_clock::now();
+    for (RowBatch b; channel.take(b);) {
+        if (metered) metrics.observe_queue_wait(0, ns_since(b.queued_at));
+        stream_batch(pool, pb, b, c, metered ? &metrics : nullptr);
+        if (metered) {
+            metrics.add_job(0, 2ull * b.rows * K * N, sizeof(double) * (uint64_t)b.rows * (K + N));
+        }
+        if (!quiet) {
+            PhaseScope phase(kPhaseEpilogue);
+            for (int r = 0; r < b.rows; ++r) {
+                for (int j = 0; j < N; ++j) cout << (j ? " " : "") << c[(size_t)r * N + j];
+                cout << "\n";
+            }
+            cout.flush();
+        }
+        if (check) {
+            for (int r = 0; r < b.rows; ++r) {
+                for (int j = 0; j < N; ++j) {
+                    double sum = 0.0;
+                    for (int k = 0; k < K; ++k) sum += b.a[(size_t)r * K + k] * getB(B, k, j, N);
+                    max_err = max(max_err, abs(sum - c[(size_t)r * N + j]));
+                }
+            }
+        }
+        latency_ns.record(ns_since(b.first_arrival));
+        rows_out += b.rows;
+        ++batches;
+    }
+    reader.join();
+    exporter.stop();
+    if (profiling) {
+        pool.run([&](int) { profiler.detach_current_thread(); });
+        profiler.stop();
+    }
+    const double secs = chrono::duration<double>(chrono::steady_clock::now() - t0).count();
+    if (bad_input) {
+        cerr << "Malformed input: a partial row or a non-number (expected " << K << " numbers per row)\n";
+        return 1;
+    }
+
+    auto pct = [&](double q) { return latency_ns.percentile(q) / 1e6; };
+    cerr << "Streamed " << rows_out << " rows in " << batches << " batches (K=" << K << ", N=" << N
+         << ", batch " << batch << ", T=" << T << "): " << rows_out / max(secs, 1e-9) << " rows/s\n";
+    cerr << "Batch latency (first row in -> C rows out): p50 " << pct(0.5) << " ms, p99 " << pct(0.99)
+         << " ms, max " << latency_ns.max_value() / 1e6 << " ms\n";
+    cerr << "Peak queued batches: " << channel.peak() << " of " << depth << " (A buffer bound "
+         << (size_t)(depth + 2) * batch * K * sizeof(double) / 1024 << " KiB)\n";
+    if (check) cerr << "Max |C - C_ref|: " << max_err << "\n";
+    if (profiling) {
+        profiler.report(cerr);
+        if (!profiler.write_collapsed(profile_path)) cerr << "Cannot write " << profile_path << "\n";
+    }
+    return 0;
+}
+
+// ---------------------------------------------------------------------------
+// Soak: sustained throughput and clock drift
+// ---------------------------------------------------------------------------
+
+// Current clock of every CPU in MHz: cpufreq's scaling_cur_freq when present,
+// otherwise the "cpu MHz" lines of /proc/cpuinfo. Empty if neither exists.
+vector<double> read_cpu_mhz()
+{
+    vector<double> mhz;
+    const int ncpu = max(1, (int)thread::hardware_concurrency());
+    for (int c = 0; c < ncpu; ++c) {
+        uint64_t khz;
+        if (!read_u64("/sys/devices/system/cpu/cpu" + to_string(c) + "/cpufreq/scaling_cur_freq", khz)) break;
+        mhz.push_back(khz / 1000.0);
+    }
+    if (!mhz.empty()) return mhz;
+    ifstream in("/proc/cpuinfo");
+    for (string line; getline(in, line);) {
+        if (line.rfind("cpu MHz", 0) != 0) continue;
+        const size_t colon = line.find(':');
+        if (colon != string::npos) mhz.push_back(stod(line.substr(colon + 1)));
+    }
+    return mhz;
+}
+
+struct SoakSample {
+    double t_s;          // end of the interval, seconds since start
+    double gflops;
+    double mean_mhz, min_mhz;
+};
+
+// Usage: prog soak M K N T [--seconds=S] [--interval-ms=ms] [--drop=pct] [--repro]
+// Runs the tiled multiply back to back for S seconds. Throughput is counted
+// per finished tile (through on_tile), so intervals shorter than one multiply
+// still measure correctly; the last multiply is cut off by a deadline.
+int run_soak(int argc, char** argv)
+{
+    if (argc < 6) {
+        cerr << "Usage: " << argv[0] << " soak M K N T [--seconds=S] [--interval-ms=ms] [--drop=pct] [--repro]\n";
+        return 1;
+    }
+    const int M = stoi(argv[2]);
+    const int K = stoi(argv[3]);
+    const int N = stoi(argv[4]);
+    const int T = max(1, stoi(argv[5]));
+    double seconds = 60.0, drop_pct = 5.0;
+    int interval_ms = 1000;
+    EngineOptions opts;
+    for (int i = 6; i < argc; ++i) {
+        string flag = argv[i];
+        if (flag.rfind("--seconds=", 0) == 0) seconds = stod(flag.substr(10));
+        else if (flag.rfind("--interval-ms=", 0) == 0) interval_ms = max(10, stoi(flag.substr(14)));
+        else if (flag.rfind("--drop=", 0) == 0) drop_pct = stod(flag.substr(7));
+        else if (flag == "--repro") opts.reproducible = true;
+        else {
+            cerr << "Unknown flag: " << flag << "\n";
+            return 1;
+        }
+    }
+
+    mt19937_64 rng(42);
+    uniform_real_distribution<double> dist(-1.0, 1.0);
+    vector<double> A((size_t)M * K), B((size_t)K * N), C((size_t)M * N);
+    for (auto& v : A) v = dist(rng);
+    for (auto& v : B) v = dist(rng);
+
+    EngineContext ctx(T, opts);
+    CancelToken token;
+    atomic<long long> flops{0};
+    TiledOptions topt;
+    topt.cancel = &token;
+    topt.on_tile = [&](size_t, const Tile& tl) {
+        flops.fetch_add(2LL * (tl.i1 - tl.i0) * (tl.j1 - tl.j0) * K, memory_order_relaxed);
+    };
+
+    const auto start = chrono::steady_clock::now();
+    token.set_deadline(start + chrono::microseconds((long long)(seconds * 1e6)));
+    const bool have_freq = !read_cpu_mhz().empty();
+    cout << "Soak (" << M << "x" << K << "x" << N << ", T=" << T << ", " << seconds << " s, interval "
+         << interval_ms << " ms)" << (have_freq ? "" : "; CPU frequency not available") << "\n";
+    cout << "    t(s)   GFLOP/s   mean MHz   min MHz\n";
+
+    // Sampler: one row per interval, printed as it goes. Only the finished
+    // flag ends it; a tick that fell behind skips the slots it missed rather
+    // than producing a short interval. The interval cut off by the end of the
+    // run is kept (and labelled) only if it covers at least half a period.
+    vector<SoakSample> samples;
+    atomic<bool> finished{false};
+    thread sampler([&] {
+        long long last_flops = 0;
+        auto last = start;
+        const auto period = chrono::milliseconds(interval_ms);
+        for (long long n = 1;; ++n) {
+            auto due = start + n * period;
+            while (due <= last) due = start + ++n * period;
+            while (!finished.load() && chrono::steady_clock::now() < due) {
+                this_thread::sleep_for(min<chrono::steady_clock::duration>(due - chrono::steady_clock::now(),
+                                                                            chrono::milliseconds(20)));
+            }
+            const bool tail = finished.load();
+            const auto now = chrono::steady_clock::now();
+            const long long f = flops.load(memory_order_relaxed);
+            const double dt = chrono::duration<double>(now - last).count();
+            if (tail && dt < interval_ms * 0.5e-3) break;
+            const vector<double> mhz = read_cpu_mhz();
+            SoakSample s;
+            s.t_s = chrono::duration<double>(now - start).count();
+            s.gflops = (f - last_flops) / dt / 1e9;
+            s.mean_mhz = mhz.empty() ? 0.0 : accumulate(mhz.begin(), mhz.end(), 0.0) / mhz.size();
+            s.min_mhz = mhz.empty() ? 0.0 : *min_element(mhz.begin(), mhz.end());
+            samples.push_back(s);
+            char row[64];
+            snprintf(row, sizeof(row), "%8.1f %9.3f %10.0f %9.0f%s", s.t_s, s.gflops, s.mean_mhz, s.min_mhz,
+                     tail ? "   (tail)" : "");
+            cout << row << endl;
+            if (tail) break;
+            last = now;
+            last_flops = f;
+        }
+    });
+
+    long long runs = 0;
+    while (!token.stop_requested()) {
+        multiply_tiled(ctx, A, B, C, M, K, N, topt);
+        ++runs;
+    }
+    finished = true;
+    sampler.join();
+
+    if (samples.size() < 2) {
+        cout << "Too few intervals for a trend; run longer or use a shorter --interval-ms\n";
+        return 0;
+    }
+    // Reference = best of the first three intervals (the first can include
+    // warm-up). Onset = first interval from which throughput (or the mean
+    // clock) stays more than drop_pct below the reference for 3 intervals.
+    const size_t n = samples.size();
+    const size_t head = min<size_t>(3, n);
+    double ref = 0.0, ref_mhz = 0.0;
+    for (size_t i = 0; i < head; ++i) {
+        ref = max(ref, samples[i].gflops);
+        ref_mhz = max(ref_mhz, samples[i].mean_mhz);
+    }
+    double mean = 0.0;
+    for (const auto& s : samples) mean += s.gflops;
+    mean /= n;
+    double var = 0.0;
+    for (const auto& s : samples) var += (s.gflops - mean) * (s.gflops - mean);
+    const double stddev = sqrt(var / (n - 1));
+    const size_t tail = max<size_t>(1, n / 10);
+    double tail_mean = 0.0;
+    for (size_t i = n - tail; i < n; ++i) tail_mean += samples[i].gflops;
+    tail_mean /= tail;
+
+    auto onset = [&](auto value, double reference) -> int {
+        const double limit = reference * (1.0 - drop_pct / 100.0);
+        for (size_t i = 0; i + 3 <= n; ++i) {
+            if (value(samples[i]) < limit && value(samples[i + 1]) < limit && value(samples[i + 2]) < limit) {
+                return (int)i;
+            }
+        }
+        return -1;
+    };
+    const int perf_onset = onset([](const SoakSample& s) { return s.gflops; }, ref);
+    const int freq_onset = have_freq ? onset([](const SoakSample& s) { return s.mean_mhz; }, ref_mhz) : -1;
+    auto when = [&](int i) {
+        if (i < 0) return string("none");
+        char buf[32];
+        snprintf(buf, sizeof(buf), "from t=%.1f s", samples[i].t_s);
+        return string(buf);
+    };
+
+    cout << "Multiplies: " << runs << " (last one cut at the deadline)\n";
+    cout << "Throughput: start " << ref << " GFLOP/s, end (last " << tail << " intervals) " << tail_mean
+         << " GFLOP/s, decay " << 100.0 * (1.0 - tail_mean / ref) << "%\n";
+    cout << "Variation: mean " << mean << " GFLOP/s, stddev " << stddev << " (CV " << 100.0 * stddev / mean << "%)\n";
+    cout << "Throughput drop > " << drop_pct << "%: "
+         << when(perf_onset) << "\n";
+    if (have_freq) {
+        cout << "Clock drop > " << drop_pct << "% (throttling): "
+             << when(freq_onset) << "\n";
+    }
+    return 0;
+}
+
+// ---------------------------------------------------------------------------
+// Open-loop load generator: latency under Poisson arrivals
+// ---------------------------------------------------------------------------
+
+struct LoadShape {
+    int M, K, N;
+    double weight;
+    vector<double> A, B;   // shared, read-only operands
+};
+
+// "MxKxN:weight,MxKxN:weight,..."; weights are relative.
+bool parse_shape_mix(const string& spec, vector<LoadShape>& shapes)
+{
+    size_t pos = 0;
+    while (pos < spec.size()) {
+        size_t end = spec.find(',', pos);
+        if (end == string::npos) end = spec.size();
+        const string item = spec.substr(pos, end - pos);
+        LoadShape s;
+        s.weight = 1.0;
+        char sep1 = 0, sep2 = 0;
+        int consumed = 0;
+        if (sscanf(item.c_str(), "%d%c%d%c%d%n", &s.M, &sep1, &s.K, &sep2, &s.N, &consumed) != 5 ||
+            sep1 != 'x' || sep2 != 'x' || s.M <= 0 || s.K <= 0 || s.N <= 0) {
+            return false;
+        }
+        if (consumed < (int)item.size()) {
+            if (item[consumed] != ':') return false;
+            s.weight = stod(item.substr(consumed + 1));
+            if (s.weight <= 0) return false;
+        }
+        shapes.push_back(move(s));
+        pos = end + 1;
+    }
+    return !shapes.empty();
+}
+
+struct LoadJob {
+    int shape;
+    chrono::steady_clock::time_point intended;   // scheduled arrival
+};
+
+// Usage: prog load W rate_per_s seconds [--mix=MxKxN:w,...] [--job-threads=J]
+// A generator thread schedules jobs at exponential inter-arrival times and
+// enqueues each at its scheduled time, never waiting for completions (open
+// loop). W servers, each with its own J-thread context, take jobs FIFO.
+// Latency is measured from the scheduled arrival, so a stalled generator or
+// a backlog shows up in the numbers instead of being hidden.
+int run_load(int argc, char** argv)
+{
+    if (argc < 5) {
+        cerr << "Usage: " << argv[0] << " load W rate_per_s seconds [--mix=MxKxN:w,...] [--job-threads=J]\n";
+        return 1;
+    }
+    const int W = max(1, stoi(argv[2]));
+    const double rate = stod(argv[3]);
+    const double seconds = stod(argv[4]);
+    string mix = "64x64x64:0.6,128x128x128:0.3,256x256x256:0.1";
+    int job_threads = 1;
+    for (int i = 5; i < argc; ++i) {
+        string flag = argv[i];
+        if (flag.rfind("--mix=", 0) == 0) mix = flag.substr(6);
+        else if (flag.rfind("--job-threads=", 0) == 0) job_threads = max(1, stoi(flag.substr(14)));
+        else {
+            cerr << "Unknown flag: " << flag << "\n";
+            return 1;
+        }
+    }
+    vector<LoadShape> shapes;
+    if (rate <= 0 || seconds <= 0 || !parse_shape_mix(mix, shapes)) {
+        cerr << "Need rate > 0, seconds > 0 and a mix like 64x64x64:0.7,256x256x256:0.3\n";
+        return 1;
+    }
+    mt19937_64 rng(42);
+    uniform_real_distribution<double> val(-1.0, 1.0);
+    vector<double> weights;
+    for (auto& s : shapes) {
+        s.A.resize((size_t)s.M * s.K);
+        s.B.resize((size_t)s.K * s.N);
+        for (auto& v : s.A) v = val(rng);
+        for (auto& v : s.B) v = val(rng);
+        weights.push_back(s.weight);
+    }
+
+    mutex qmtx;
+    condition_variable qcv;
+    deque<LoadJob> queue;
+    bool closed = false;
+    size_t max_depth = 0;
+
+    struct ServerStats {
+        HdrHistogram latency, queue_delay, service;
+        vector<long long> per_shape;
+        double busy_s = 0.0;
+    };
+    vector<ServerStats> stats(W);
+    vector<thread> servers;
+    for (int w = 0; w < W; ++w) {
+        servers.emplace_back([&, w] {
+            EngineContext ctx(job_threads);
+            TiledOptions topt;
+            ServerStats& st = stats[w];
+            st.per_shape.assign(shapes.size(), 0);
+            vector<double> C;
+            for (;;) {
+                LoadJob job;
+                {
+                    unique_lock<mutex> lk(qmtx);
+                    qcv.wait(lk, [&] { return !queue.empty() || closed; });
+                    if (queue.empty()) return;
+                    job = queue.front();
+                    queue.pop_front();
+                }
+                const LoadShape& s = shapes[job.shape];
+                const auto begin = chrono::steady_clock::now();
+                C.assign((size_t)s.M * s.N, 0.0);
+                multiply_tiled(ctx, s.A, s.B, C, s.M, s.K, s.N, topt);
+                const auto end = chrono::steady_clock::now();
+                auto ns = [](chrono::steady_clock::duration d) {
+                    return (uint64_t)max<long long>(0, chrono::duration_cast<chrono::nanoseconds>(d).count());
+                };
+                st.queue_delay.record(ns(begin - job.intended));
+                st.service.record(ns(end - begin));
+                st.latency.record(ns(end - job.intended));
+                st.busy_s += chrono::duration<double>(end - begin).count();
+                ++st.per_shape[job.shape];
+            }
+        });
+    }
+
+    // Generator: absolute schedule, so sleeping late never thins the load.
+    exponential_distribution<double> gap(rate);
+    discrete_distribution<int> pick(weights.begin(), weights.end());
+    const auto start = chrono::steady_clock::now();
+    long long offered = 0;
+    double t = gap(rng);
+    while (t < seconds) {
+        const auto due = start + chrono::nanoseconds((long long)(t * 1e9));
+        this_thread::sleep_until(due);
+        {
+            lock_guard<mutex> lk(qmtx);
+            queue.push_back({pick(rng), due});
+            max_depth = max(max_depth, queue.size());
+        }
+        qcv.notify_one();
+        ++offered;
+        t += gap(rng);
+    }
+    {
+        lock_guard<mutex> lk(qmtx);
+        closed = true;
+    }
+    qcv.notify_all();
+    for (auto& th : servers) th.join();
+    const double elapsed = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    ServerStats all;
+    all.per_shape.assign(shapes.size(), 0);
+    for (const auto& st : stats) {
+        all.latency.merge(st.latency);
+        all.queue_delay.merge(st.queue_delay);
+        all.service.merge(st.service);
+        all.busy_s += st.busy_s;
+        for (size_t i = 0; i < shapes.size(); ++i) all.per_shape[i] += st.per_shape[i];
+    }
+
+    auto ms = [](uint64_t ns) { return ns / 1e6; };
+    auto line = [&](const char* name, const HdrHistogram& h) {
+        cout << name << ": p50 " << ms(h.percentile(0.5)) << " ms, p99 " << ms(h.percentile(0.99))
+             << " ms, p99.9 " << ms(h.percentile(0.999)) << " ms, max " << ms(h.max_value())
+             << " ms, mean " << h.mean() / 1e6 << " ms\n";
+    };
+    cout << "Open-loop load (W=" << W << " servers x " << job_threads << " threads, " << rate << " jobs/s offered, "
+         << seconds << " s): " << offered << " jobs, " << offered / elapsed << " jobs/s completed over "
+         << elapsed << " s\n";
+    cout << "Mix:";
+    for (size_t i = 0; i < shapes.size(); ++i) {
+        cout << " " << shapes[i].M << "x" << shapes[i].K << "x" << shapes[i].N << "=" << all.per_shape[i];
+    }
+    cout << "\n";
+    cout << "Server utilization: " << 100.0 * all.busy_s / (W * elapsed) << "%, max queue depth " << max_depth << "\n";
+    line("Latency (arrival -> done)", all.latency);
+    line("Queueing delay", all.queue_delay);
+    line("Service time", all.service);
+    return 0;
+}
+
+int main(int argc, char** argv)
+{
+    if (argc >= 2) {
+        string mode = argv[1];
+        if (mode == "band") return run_band(argc, argv);
+        if (mode == "group") return run_group(argc, argv);
+        if (mode == "pdist") return run_pdist(argc, argv);
+        if (mode == "graph") return run_graph(argc, argv);
+        if (mode == "editdist") return run_editdist(argc, argv);
+        if (mode == "align") return run_align(argc, argv);
+        if (mode == "dag") return run_dag(argc, argv);
+        if (mode == "memo") return run_memo(argc, argv);
+        if (mode == "dtw") return run_dtw(argc, argv);
+        if (mode == "tilefile") return run_tilefile(argc, argv);
+        if (mode == "stream") return run_stream(argc, argv);
+        if (mode == "scrape") return run_scrape(argc, argv);
+        if (mode == "soak") return run_soak(argc, argv);
+        if (mode == "load") return run_load(argc, argv);
+    }
+
+    // Usage: prog M K N T strategy[rows|cols|everyk] [--debug] [--random] [--repro] [--detect]
+    //             [--shapeA=kind] [--shapeB=kind] [--colA] [--colB] [--jobs=J]
+    //             [--hier] [--domains=D] [--load-a=path] [--tiled]
+    //             [--checkpoint=path] [--checkpoint-ms=ms] [--resume] [--stop-after=tiles]
+    //             [--deadline-ms=ms] [--cancel-after-ms=ms] [--stream]
+    //             [--metrics=path] [--metrics-shm=/name] [--metrics-ms=ms]
+    //             [--profile=path] [--profile-hz=hz] [--energy]
+    if (argc < 6) {
+        cerr << "Usage: " << argv[0] << " M K N T strategy(rows|cols|everyk) [--debug] [--random] [--repro]"
+             << " [--detect] [--shapeA=kind] [--shapeB=kind] [--colA] [--colB] [--jobs=J]"
+             << " [--hier] [--domains=D] [--load-a=path] [--tiled]"
+             << " [--checkpoint=path] [--checkpoint-ms=ms] [--resume] [--stop-after=tiles]"
+             << " [--deadline-ms=ms] [--cancel-after-ms=ms] [--stream]"
+             << " [--metrics=path] [--metrics-shm=/name] [--metrics-ms=ms]"
+             << " [--profile=path] [--profile-hz=hz] [--energy]\n";
+        return 1;
+    }
+
+    const int M = stoi(argv[1]);
+    const int K = stoi(argv[2]);
+    const int N = stoi(argv[3]);
+    const int T = max(1, stoi(argv[4]));
+    string sarg = argv[5];
+
+    Strategy strat = Strategy::Rows;
+    if (sarg == "cols")    strat = Strategy::Cols;
+    else if (sarg == "everyk") strat = Strategy::EveryK;
+    else if (sarg != "rows") {
+        cerr << "Unknown strategy: " << sarg << " (use rows|cols|everyk)\n";
+        return 1;
+    }
+
+    EngineOptions opts;
+    bool use_random = false;
+    bool detect = false;
+    int jobs = 1;
+    bool hier = false;
+    int sim_domains = 0;
+    string load_a;
+    bool tiled = false;
+    TiledOptions topt;
+    long long stop_after = -1;
+    double deadline_ms = -1.0, cancel_ms = -1.0;
+    bool stream = false;
+    string metrics_path, metrics_shm;
+    int metrics_ms = 1000;
+    string profile_path;
+    int profile_hz = 997;
+    bool energy = false;
+    Layout layoutA = Layout::RowMajor, layoutB = Layout::RowMajor;
+    string shapeA = "dense", shapeB = "dense";
+    for (int i = 6; i < argc; ++i) {
+        string flag = argv[i];
+        if (flag == "--debug") opts.debug = true;
+        else if (flag == "--repro") opts.reproducible = true;
+        else if (flag == "--random") use_random = true;
+        else if (flag == "--detect") detect = true;
+        else if (flag == "--colA") layoutA = Layout::ColMajor;
+        else if (flag == "--colB") layoutB = Layout::ColMajor;
+        else if (flag.rfind("--jobs=", 0) == 0) jobs = max(1, stoi(flag.substr(7)));
+        else if (flag == "--hier") hier = true;
+        else if (flag.rfind("--load-a=", 0) == 0) load_a = flag.substr(9);
+        else if (flag == "--tiled") tiled = true;
+        else if (flag.rfind("--checkpoint=", 0) == 0) { tiled = true; topt.checkpoint_path = flag.substr(13); }
+        else if (flag.rfind("--checkpoint-ms=", 0) == 0) topt.checkpoint_interval_ms = max(1, stoi(flag.substr(16)));
+        else if (flag == "--resume") topt.resume = true;
+        else if (flag.rfind("--stop-after=", 0) == 0) { tiled = true; stop_after = stoll(flag.substr(13)); }
+        else if (flag.rfind("--deadline-ms=", 0) == 0) { tiled = true; deadline_ms = stod(flag.substr(14)); }
+        else if (flag.rfind("--cancel-after-ms=", 0) == 0) { tiled = true; cancel_ms = stod(flag.substr(18)); }
+        else if (flag == "--stream") { tiled = true; stream = true; }
+        else if (flag.rfind("--metrics=", 0) == 0) metrics_path = flag.substr(10);
+        else if (flag.rfind("--metrics-shm=", 0) == 0) metrics_shm = flag.substr(14);
+        else if (flag.rfind("--metrics-ms=", 0) == 0) metrics_ms = stoi(flag.substr(13));
+        else if (flag.rfind("--profile=", 0) == 0) profile_path = flag.substr(10);
+        else if (flag.rfind("--profile-hz=", 0) == 0) profile_hz = stoi(flag.substr(13));
+        else if (flag == "--energy") energy = true;
+        else if (flag.rfind("--domains=", 0) == 0) { hier = true; sim_domains = stoi(flag.substr(10)); }
+        else if (flag.rfind("--shapeA=", 0) == 0) shapeA = flag.substr(9);
+        else if (flag.rfind("--shapeB=", 0) == 0) shapeB = flag.substr(9);
+        else {
+            cerr << "Unknown flag: " << flag << "\n";
+            return 1;
+        }
+    }
+
+    // Allocate A, B, C
+    vector<double> A(M * K), B(K * N), C(M * N, 0.0);
+
+    // One context (and so one set of threads) for everything below: loading,
+    // layout conversion, the structure pre-pass and the multiply itself.
+    EngineContext ctx(T, opts);
+
+    // Initialize inputs:
+    // - Default: simple deterministic iota (1,2,3,...) to keep results stable
+    // - Optional: --random to explore cache/branching less deterministically
+    if (use_random) {
+        mt19937_64 rng(42);
+        uniform_real_distribution<double> dist(-1.0, 1.0);
+        for (auto& v : A) v = dist(rng);
+        for (auto& v : B) v = dist(rng);
+    } else {
+        iota(A.begin(), A.end(), 1.0);
+        iota(B.begin(), B.end(), 1.0);
+    }
+
+    // --load-a=path: A comes from a tile-compressed file (decoded in parallel).
+    if (!load_a.empty()) {
+        int rows = 0, cols = 0;
+        string err;
+        auto l0 = chrono::high_resolution_clock::now();
+        if (!load_tiled(load_a, A, rows, cols, ctx.pool, err)) {
+            cerr << "Cannot load A: " << err << "\n";
+            return 1;
+        }
+        if (rows != M || cols != K) {
+            cerr << "Cannot load a " << M << "x" << K << " matrix from " << load_a << ": file holds "
+                 << rows << "x" << cols << "\n";
+            return 1;
+        }
+        auto l1 = chrono::high_resolution_clock::now();
+        cout << "Loaded A from " << load_a << ": " << chrono::duration<double, milli>(l1 - l0).count() << " ms\n";
+    }
+
+    // Optional structured inputs (identity|diagonal|perm|lower|upper|sym|band|sparse)
+    if (!apply_shape(A, M, K, shapeA, 7) || !apply_shape(B, K, N, shapeB, 8)) {
+        cerr << "Unknown or non-square shape: " << shapeA << " / " << shapeB << "\n";
+        return 1;
+    }
+    if ((detect || hier || tiled) && (layoutA != Layout::RowMajor || layoutB != Layout::RowMajor)) {
+        cerr << "--detect/--hier/--tiled expect row-major operands\n";
+        return 1;
+    }
+    if (detect && opts.reproducible) {
+        cerr << "--detect kernels do not follow the --repro summation order\n";
+        return 1;
+    }
+    if (topt.resume && topt.checkpoint_path.empty()) {
+        cerr << "--resume needs --checkpoint=path\n";
+        return 1;
+    }
+
+    // --colA/--colB: hand the kernel column-major copies (as a Fortran/R
+    // producer would); A and B stay row-major for the baseline check.
+    auto c0 = chrono::high_resolution_clock::now();
+    vector<double> A_in = convert_layout(A, M, K, Layout::RowMajor, layoutA, ctx.pool);
+    vector<double> B_in = convert_layout(B, K, N, Layout::RowMajor, layoutB, ctx.pool);
+    auto c1 = chrono::high_resolution_clock::now();
+    if (layoutA != Layout::RowMajor || layoutB != Layout::RowMajor) {
+        double conv_ms = chrono::duration<double, milli>(c1 - c0).count();
+        size_t moved = (layoutA != Layout::RowMajor ? A.size() : 0) +
+                       (layoutB != Layout::RowMajor ? B.size() : 0);
+        cout << "Layout conversion (T=" << T << "): " << conv_ms << " ms, "
+             << 2.0 * moved * sizeof(double) / (conv_ms * 1e6) << " GB/s\n";
+    }
+
+    // Prepare tasks for chosen strategy
+    auto tasks_per_thread = make_tasks(M, N, T, strat);
+
+    // --metrics / --metrics-shm: exported during and after the multiply; the
+    // tiled and hierarchical paths also record per-tile kernel latency.
+    Metrics metrics(T);
+    MetricsExporter exporter;
+    const bool metered = !metrics_path.empty() || !metrics_shm.empty();
+    if (metered) {
+        string err;
+        if (!exporter.start(metrics, metrics_path, metrics_shm, metrics_ms, err)) {
+            cerr << err << "\n";
+            return 1;
+        }
+    }
+    SamplingProfiler profiler;
+    if (!profile_path.empty()) {
+        string err;
+        if (!profiler.start(T, profile_hz, err)) {
+            cerr << err << "\n";
+            return 1;
+        }
+    }
+    // --energy: package (+DRAM) joules around the threaded run and the baseline.
+    // Missing counters are reported, not fatal.
+    EnergyMeter meter;
+    string energy_why;
+    const bool metering_energy = energy && meter.init(energy_why);
+    EnergyReading energy_threaded, energy_baseline;
+    if (metering_energy) meter.start();
+
+    // Time the threaded multiplication (compute + join; the pool already exists)
+    auto t0 = chrono::high_resolution_clock::now();
+
+    // --detect: structure pre-pass first; fall through to the general kernel
+    // only if no specialized path applies.
+    string path;
+    MatrixStructure sa, sb;
+    if (detect) path = multiply_structured(A, B, C, M, K, N, ctx.pool, &sa, &sb);
+
+    if (metered) ctx.metrics = &metrics;
+    if (!profile_path.empty()) ctx.pool.run([&](int) { profiler.attach_current_thread("worker"); });
+    vector<CpuDomain> domains;
+    HierStats hstats;
+    TiledResult tres;
+    size_t stream_tiles = 0;
+    atomic<int> stream_bands{0};
+    double stream_sum = 0.0, stream_first_ms = 0.0, stream_last_ms = 0.0;
+    if (path.empty() && hier) {
+        domains = sim_domains > 0 ? simulated_domains(sim_domains) : detect_cpu_domains();
+        multiply_hierarchical(ctx, domains, A, B, C, M, K, N, hstats);
+        path = "hierarchical";
+    } else if (path.empty() && tiled) {
+        // --deadline-ms: the job expires on its own; --cancel-after-ms: another
+        // thread cancels it (e.g. the client went away).
+        CancelToken token;
+        if (deadline_ms >= 0) {
+            token.set_deadline(chrono::steady_clock::now() +
+                               chrono::microseconds((long long)(deadline_ms * 1000)));
+        }
+        topt.cancel = &token;
+        mutex cmtx;
+        condition_variable ccv;
+        bool job_done = false;
+        thread canceller;
+        if (cancel_ms >= 0) {
+            canceller = thread([&] {
+                unique_lock<mutex> lk(cmtx);
+                if (!ccv.wait_for(lk, chrono::microseconds((long long)(cancel_ms * 1000)),
+                                  [&] { return job_done; })) {
+                    token.cancel();
+                }
+            });
+        }
+        // --stream: a downstream stage reduces each tile of C while the rest
+        // of the product is still being computed.
+        ReadyQueue ready(256);
+        thread consumer;
+        if (stream) {
+            topt.ready = &ready;
+            topt.on_rows = [&](int, int) { stream_bands.fetch_add(1, memory_order_relaxed); };
+            consumer = thread([&] {
+                vector<Tile> order;
+                append_tiles(order, 0, M, N, topt.tile);
+                for (size_t k; ready.pop_wait(k);) {
+                    const Tile& tl = order[k];
+                    for (int i = tl.i0; i < tl.i1; ++i) {
+                        for (int j = tl.j0; j < tl.j1; ++j) stream_sum += getC(C, i, j, N);
+                    }
+                    const double at = chrono::duration<double, milli>(chrono::high_resolution_clock::now() - t0).count();
+                    if (stream_tiles++ == 0) stream_first_ms = at;
+                    stream_last_ms = at;
+                }
+            });
+        }
+        // --stop-after: simulated preemption once that many tiles of C are
+        // done (resumed ones included) -- no cleanup, no final checkpoint.
+        // Chained after any tile callback already installed.
+        atomic<long long> tiles_done{0};
+        const auto prev_on_tile = topt.on_tile;
+        if (stop_after >= 0) {
+            topt.on_tile = [&, prev_on_tile](size_t k, const Tile& tl) {
+                if (prev_on_tile) prev_on_tile(k, tl);
+                const long long c = tiles_done.fetch_add(1, memory_order_relaxed) + 1;
+                if (c == max(1LL, stop_after)) {   // exactly one thread reports and exits
+                    cout << "Stopping abruptly after " << c << " tiles" << endl;
+                    _Exit(75);
+                }
+            };
+        }
+        tres = multiply_tiled(ctx, A, B, C, M, K, N, topt);
+        if (consumer.joinable()) consumer.join();
+        topt.ready = nullptr;
+        topt.on_rows = nullptr;
+        topt.on_tile = prev_on_tile;
+        if (canceller.joinable()) {
+            {
+                lock_guard<mutex> lk(cmtx);
+                job_done = true;
+            }
+            ccv.notify_one();
+            canceller.join();
+        }
+        topt.cancel = nullptr;
+        if (!tres.ok) {
+            cerr << tres.error << "\n";
+            return 1;
+        }
+        path = "tiled";
+    } else if (path.empty()) {
+        multiply_tasks(ctx, tasks_per_thread, A_in, B_in, C, M, K, N, layoutA, layoutB);
+    }
+
+    if (!profile_path.empty()) {
+        ctx.pool.run([&](int) { profiler.detach_current_thread(); });
+        profiler.stop();
+    }
+
+    auto t1 = chrono::high_resolution_clock::now();
+    double threaded_ms = chrono::duration<double, milli>(t1 - t0).count();
+    if (metering_energy) energy_threaded = meter.stop();
+    if (metered) {
+        metrics.add_job(0, 2ull * M * K * N, sizeof(double) * ((uint64_t)M * K + (uint64_t)K * N + (uint64_t)M * N));
+        exporter.stop();
+    }
+
+    if (detect) {
+        cout << "Detected A: " << describe_structure(sa) << "\n";
+        cout << "Detected B: " << describe_structure(sb) << "\n";
+        cout << "Dispatch: " << (path.empty() ? "general kernel" : path) << "\n";
+    }
+    if (hier) {
+        cout << "Domains: " << min((int)domains.size(), T) << (sim_domains > 0 ? " (simulated)" : "")
+             << ", tiles: " << hstats.local.load() << " local, " << hstats.stolen_in_domain.load()
+             << " stolen in-domain, " << hstats.stolen_across.load() << " stolen across domains\n";
+    }
+    if (tiled) {
+        cout << "Tiles: " << tres.tiles_total << " total, " << tres.tiles_resumed << " resumed from checkpoint, "
+             << tres.tiles_computed << " computed";
+        if (!topt.checkpoint_path.empty()) cout << ", " << tres.checkpoints_written << " checkpoint commits";
+        cout << "\n";
+        if (tres.stopped) {
+            size_t ok_tiles = count(tres.completed.begin(), tres.completed.end(), 1);
+            cout << "Stopped early: " << ok_tiles << " of " << tres.tiles_total << " tiles complete\n";
+        }
+        if (stream) {
+            cout << "Streamed " << stream_tiles << " tiles (" << stream_bands.load()
+                 << " full row blocks) to the consumer: first at " << stream_first_ms
+                 << " ms, last at " << stream_last_ms << " ms\n";
+        }
+    }
+    cout << "Threaded (" << sarg << ", T=" << T << "): " << threaded_ms << " ms\n";
+    if (!profile_path.empty()) {
+        profiler.report(cout);
+        if (!profiler.write_collapsed(profile_path)) cerr << "Cannot write " << profile_path << "\n";
+    }
+
+    // Baseline single-thread timing + correctness check
+    if (metering_energy) meter.start();
+    auto b0 = chrono::high_resolution_clock::now();
+    vector<double> C_ref = multiply_baseline(A, B, M, K, N);
+    auto b1 = chrono::high_resolution_clock::now();
+    if (metering_energy) energy_baseline = meter.stop();
+    double baseline_ms = chrono::duration<double, milli>(b1 - b0).count();
+
+    double diff = max_abs_diff(C, C_ref);
+    if (tres.stopped) {
+        // Only the completed tiles hold results; compare just those.
+        diff = 0.0;
+        for (size_t k = 0; k < tres.tiles.size(); ++k) {
+            if (!tres.completed[k]) continue;
+            const Tile& tl = tres.tiles[k];
+            for (int i = tl.i0; i < tl.i1; ++i) {
+                for (int j = tl.j0; j < tl.j1; ++j) diff = max(diff, abs(getC(C, i, j, N) - getC(C_ref, i, j, N)));
+            }
+        }
+    }
+    cout << "Baseline (1 thread): " << baseline_ms << " ms\n";
+    cout << "Max |C - C_ref|: " << diff << "\n";
+    if (energy && !metering_energy) {
+        cout << "Energy: unavailable (" << energy_why << ")\n";
+    } else if (metering_energy) {
+        double done_frac = 1.0;
+        if (tres.stopped) done_frac = (double)count(tres.completed.begin(), tres.completed.end(), 1) / tres.tiles_total;
+        print_energy(sarg + ", T=" + to_string(T), meter, energy_threaded, 2.0 * M * K * N * done_frac);
+        print_energy("baseline, 1 thread", meter, energy_baseline, 2.0 * M * K * N);
+    }
+    if (stream && !tres.stopped) {
+        double ref_sum = 0.0;
+        for (double v : C_ref) ref_sum += v;
+        cout << "Consumer sum: " << stream_sum << " (reference " << ref_sum << ")\n";
+    }
+    if (opts.reproducible) {
+        cout << "C checksum (--repro): 0x" << hex << bit_checksum(C) << dec << "\n";
+    }
+
+    // --jobs=J: J independent multiplies at once, each on its own context
+    // (own pool, options and counters), to show they do not interfere.
+    if (jobs > 1) {
+        vector<vector<double>> Cs(jobs, vector<double>(M * N, 0.0));
+        vector<long long> counted(jobs, 0);
+        auto j0 = chrono::high_resolution_clock::now();
+        vector<thread> runners;
+        for (int j = 0; j < jobs; ++j) {
+            runners.emplace_back([&, j] {
+                EngineOptions quiet = opts;
+                quiet.debug = false;
+                EngineContext job_ctx(T, quiet);
+                multiply_tasks(job_ctx, tasks_per_thread, A_in, B_in, Cs[j], M, K, N, layoutA, layoutB);
+                counted[j] = job_ctx.elements_computed();
+            });
+        }
+        for (auto& th : runners) th.join();
+        auto j1 = chrono::high_resolution_clock::now();
+        double jdiff = 0.0;
+        bool counts_ok = true;
+        for (int j = 0; j < jobs; ++j) {
+            jdiff = max(jdiff, max_abs_diff(Cs[j], C_ref));
+            counts_ok = counts_ok && counted[j] == (long long)M * N;
+        }
+        cout << "Concurrent jobs (" << jobs << " x T=" << T << "): "
+             << chrono::duration<double, milli>(j1 - j0).count() << " ms, max |C - C_ref|: " << jdiff
+             << (counts_ok ? "" : " (element counters disagree)") << "\n";
+    }
+
+    // Tiny sanity print for very small matrices (kept compact)
+    if (ctx.opts.debug && M <= 9 && N <= 9) {
+        cout << "C (threaded) first few rows:\n";
+        for (int i = 0; i < M; ++i) {
+            for (int j = 0; j < N; ++j) {
+                cout << getC(C, i, j, N) << (j + 1 == N ? '\n' : ' ');
+            }
+        }
+    }
+    return 0;
+}
+
+/*
+build command:
+g++ -O2 -std=c++17 -pthread matrix_threads.cpp -o mtmul.exe
+
+
+examples to run:
+
+small debug test:
+./mtmul.exe 9 9 9 4 rows --debug 
+
+banded / block-diagonal (compact band storage):
+./mtmul.exe band 1000 3 5 4 --random
+./mtmul.exe band 1000000 50 50 8
+./mtmul.exe band 1000 0 0 4 --block=16
+
+structure detection (kind: identity|diagonal|perm|lower|upper|sym|band|sparse):
+./mtmul.exe 1024 1024 1024 4 rows --detect --shapeA=perm
+./mtmul.exe 1024 1024 1024 4 rows --detect --random --shapeA=lower --shapeB=upper
+
+column-major operands (converted with the parallel blocked transpose):
+./mtmul.exe 1024 1024 1024 8 rows --colB
+./mtmul.exe 1024 1024 1024 8 cols --colA --colB
+
+grouped GEMM (many differently shaped products, one fork/join):
+./mtmul.exe group 32 8 --random
+
+pairwise distances (norms folded into the GEMM tile epilogue):
+./mtmul.exe pdist 4000 4000 64 8 euclid
+./mtmul.exe pdist 4000 4000 64 8 cosine --threshold=0.4
+
+masked SpGEMM (triangle counting, k-truss):
+./mtmul.exe graph 1000000 16 8
+./mtmul.exe graph 100000 16 8 --ktruss=4
+
+bit-parallel edit distance / LCS (64 DP cells per word op):
+./mtmul.exe editdist 1000 1000 8
+./mtmul.exe editdist 1000 1000 8 --lcs --rate=0.2
+
+banded (Ukkonen) edit distance, adaptive band / threshold query:
+./mtmul.exe editdist 1000 10000 8 --band --rate=0.01
+./mtmul.exe editdist 1000 10000 8 --max=50 --rate=0.01
+
+linear-space alignment with traceback (Hirschberg):
+./mtmul.exe align 60 2 --rate=0.2 --show
+./mtmul.exe align 100000 8
+
+DAG-structured DP (longest path; dependency-counting tasks or --waves):
+./mtmul.exe dag 1000000 4 8
+./mtmul.exe dag 1000000 4 8 --waves
+
+parallel top-down DP on a lock-free memo table:
+./mtmul.exe memo 100000 8
+./mtmul.exe memo 200 8 --capacity=16384 --shards=8
+
+DTW subsequence search (LB_Kim -> LB_Keogh -> batched early-abandoning DTW):
+./mtmul.exe dtw 1000000 128 12 8
+./mtmul.exe dtw 20000 128 12 4 --brute
+
+independent multiplies running concurrently on separate engine contexts:
+./mtmul.exe 512 512 512 4 rows --jobs=4
+
+hierarchical per-LLC/socket scheduling (detected, or --domains=D simulated):
+./mtmul.exe 2048 2048 2048 32 rows --hier
+./mtmul.exe 1024 1024 1024 8 rows --domains=2
+
+tile-compressed matrix files (byte shuffle + LZ, parallel decode):
+./mtmul.exe tilefile 4096 4096 8 a.mtz --kind=quantized
+./mtmul.exe 4096 512 512 8 rows --load-a=a.mtz
+
+checkpoint / restart of the tiled multiply (--stop-after simulates preemption):
+./mtmul.exe 2048 2048 2048 8 rows --checkpoint=c.ckpt --checkpoint-ms=200 --stop-after=600
+./mtmul.exe 2048 2048 2048 8 rows --checkpoint=c.ckpt --resume
+
+bitwise-reproducible results (same checksum for any T / strategy / kernel):
+./mtmul.exe 1000 3000 1000 8 rows --random --repro
+./mtmul.exe 1000 3000 1000 3 everyk --random --repro --colB
+./mtmul.exe 1000 3000 1000 5 rows --random --repro --tiled
+
+deadlines and cancellation (checked between tiles; completed tiles reported):
+./mtmul.exe 2048 2048 2048 8 rows --deadline-ms=100
+./mtmul.exe 2048 2048 2048 8 rows --cancel-after-ms=50
+
+streaming consumption of C (a consumer reduces tiles as they finish):
+./mtmul.exe 2048 2048 2048 8 rows --random --stream
+
+online row streaming (A rows from stdin or a generator, C rows out per batch):
+./mtmul.exe stream 512 256 4 --gen=100000 --quiet --check
+./mtmul.exe stream 512 256 4 --gen=20000 --rate=5000 --batch=32 --max-wait-ms=2 --quiet
+printf '1 2\n3 4\n' | ./mtmul.exe stream 2 3 2
+
+metrics (OpenMetrics text file, plus a shared-memory segment read by scrape):
+./mtmul.exe 1024 1024 1024 4 rows --tiled --metrics=/tmp/mtmul.prom --metrics-shm=/mtmul
+./mtmul.exe scrape /mtmul
+./mtmul.exe stream 512 256 4 --gen=100000 --quiet --metrics=/tmp/stream.prom --metrics-ms=500
+
+sampling profiler (per-thread CPU timers; phase breakdown + collapsed stacks for flamegraph.pl):
+./mtmul.exe 1024 1024 1024 4 rows --hier --profile=/tmp/mtmul.folded
+./mtmul.exe stream 512 256 4 --gen=50000 --profile=/tmp/stream.folded > /dev/null
+
+energy per run (RAPL via /sys/class/powercap; usually needs root):
+./mtmul.exe 2048 2048 2048 8 rows --tiled --energy
+./mtmul.exe 2048 2048 2048 2 everyk --energy
+
+soak (sustained throughput per interval, clock drift, throttling onset):
+./mtmul.exe soak 1024 1024 1024 8 --seconds=300 --interval-ms=2000
+
+open-loop load (Poisson arrivals, shape mix, tail latency and queueing delay):
+./mtmul.exe load 4 200 30
+./mtmul.exe load 2 50 20 --mix=128x128x128:0.9,512x512x512:0.1 --job-threads=2
 
 decently sized tests:
 ./mtmul.exe 512 512 512 4 rows